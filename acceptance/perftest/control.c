@@ -0,0 +1,265 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "control.h"
+
+#include <glib.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* a line longer than this is not a command, so the client is dropped */
+#define CONTROL_MAX_LINE 4096
+
+/* ...as is one that leaves this much of its replies unread */
+#define CONTROL_MAX_OUTPUT (1024 * 1024)
+
+struct Control {
+  gchar*                path;
+  int                   fd;
+  GIOChannel*           channel;
+  guint                 source;
+  const ControlCommand* commands;
+  gpointer              data;
+  GPtrArray*            clients;  /* ControlClient* */
+};
+
+typedef struct ControlClient {
+  Control*    control;
+  int         fd;               /* non-blocking */
+  GIOChannel* channel;
+  guint       source;
+  guint       output_source;    /* waiting to write, or zero */
+  GString*    input;
+  GString*    output;           /* replies not yet written */
+} ControlClient;
+
+static void control_client_free(ControlClient* client) {
+  if (client->source)
+    g_source_remove(client->source);
+  if (client->output_source)
+    g_source_remove(client->output_source);
+  g_io_channel_unref(client->channel);
+  close(client->fd);
+  g_string_free(client->input, TRUE);
+  g_string_free(client->output, TRUE);
+  g_free(client);
+}
+
+/* the caller has cleared whichever source is dispatching, if any */
+static void control_client_drop(ControlClient* client) {
+  g_ptr_array_remove(client->control->clients, client);
+  control_client_free(client);
+}
+
+/* write as much of the pending output as the socket takes, without ever
+ * blocking the main loop; returns FALSE if the client has to be dropped */
+static gboolean control_client_flush(ControlClient* client) {
+  GString* output = client->output;
+  gsize    done   = 0;
+
+  while (done < output->len) {
+    ssize_t written = write(client->fd, output->str + done, output->len - done);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    if (written <= 0)
+      return FALSE;
+    done += written;
+  }
+
+  g_string_erase(output, 0, done);
+  return output->len <= CONTROL_MAX_OUTPUT;
+}
+
+static gboolean control_client_writable(
+  GIOChannel* channel, GIOCondition condition, ControlClient* client
+) {
+  if (!control_client_flush(client)) {
+    client->output_source = 0;  /* returning FALSE removes it */
+    control_client_drop(client);
+    return FALSE;
+  }
+
+  if (client->output->len > 0)
+    return TRUE;
+
+  client->output_source = 0;
+  return FALSE;
+}
+
+static void control_help(Control* control, GString* reply) {
+  for (const ControlCommand* command = control->commands; command->name; ++command)
+    g_string_append_printf(reply, "%s %s\n", command->name, command->usage);
+  g_string_append(reply, "help\n");
+}
+
+static void control_run(Control* control, const char* line, GString* reply) {
+  GError* error = NULL;
+  gchar** argv  = NULL;
+  gint    argc  = 0;
+
+  if (!g_shell_parse_argv(line, &argc, &argv, &error)) {
+    /* a blank line is not a command, and needs no answer */
+    if (error->code != G_SHELL_ERROR_EMPTY_STRING)
+      g_string_append_printf(reply, "error: %s\n", error->message);
+    g_error_free(error);
+    return;
+  }
+
+  if (g_strcmp0(argv[0], "help") == 0) {
+    control_help(control, reply);
+    g_string_append(reply, "ok\n");
+    g_strfreev(argv);
+    return;
+  }
+
+  const ControlCommand* command = control->commands;
+  while (command->name && g_strcmp0(command->name, argv[0]) != 0)
+    ++command;
+
+  if (!command->name) {
+    g_string_append_printf(reply, "error: unknown command %s, try help\n", argv[0]);
+  } else if (argc - 1 < command->min_args || argc - 1 > command->max_args) {
+    g_string_append_printf(reply, "error: usage: %s %s\n", command->name, command->usage);
+  } else {
+    GString* output = g_string_new("");
+    if (command->handler(argv + 1, output, control->data)) {
+      g_string_append(reply, output->str);
+      g_string_append(reply, "ok\n");
+    } else {
+      g_string_append_printf(reply, "error: %s\n", output->str);
+    }
+    g_string_free(output, TRUE);
+  }
+
+  g_strfreev(argv);
+}
+
+static gboolean control_client_read(
+  GIOChannel* channel, GIOCondition condition, ControlClient* client
+) {
+  Control* control = client->control;
+  char     buffer[1024];
+  ssize_t  count   = read(client->fd, buffer, sizeof(buffer));
+
+  if (count < 0 && (errno == EINTR || errno == EAGAIN))
+    return TRUE;
+
+  if (count <= 0) {
+    client->source = 0;         /* returning FALSE removes it */
+    control_client_drop(client);
+    return FALSE;
+  }
+
+  g_string_append_len(client->input, buffer, count);
+
+  /* run every complete line, in order */
+  gchar* eol;
+  while ((eol = memchr(client->input->str, '\n', client->input->len))) {
+    *eol = '\0';
+    control_run(control, g_strchomp(client->input->str), client->output);
+    g_string_erase(client->input, 0, eol - client->input->str + 1);
+  }
+
+  if (!control_client_flush(client) || client->input->len > CONTROL_MAX_LINE) {
+    client->source = 0;
+    control_client_drop(client);
+    return FALSE;
+  }
+
+  /* whatever the socket would not take goes out once it has room */
+  if (client->output->len > 0 && !client->output_source)
+    client->output_source = g_io_add_watch(
+      client->channel, G_IO_OUT, (GIOFunc)control_client_writable, client
+    );
+
+  return TRUE;
+}
+
+static gboolean control_accept(
+  GIOChannel* channel, GIOCondition condition, Control* control
+) {
+  int fd = accept(control->fd, NULL, NULL);
+  if (fd < 0)
+    return TRUE;                /* try again with the next connection */
+
+  /* a client that stops reading must never stall the main loop */
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  ControlClient* client = g_new0(ControlClient, 1);
+  client->control = control;
+  client->fd      = fd;
+  client->input   = g_string_new("");
+  client->output  = g_string_new("");
+  client->channel = g_io_channel_unix_new(fd);
+  client->source  = g_io_add_watch(
+    client->channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+    (GIOFunc)control_client_read, client
+  );
+
+  g_ptr_array_add(control->clients, client);
+  return TRUE;
+}
+
+Control* control_start(const char* path, const ControlCommand* commands, gpointer data) {
+  struct sockaddr_un address = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    g_critical("control socket path %s is too long", path);
+    exit(1);
+  }
+  strcpy(address.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    g_critical("failed to create control socket: %s", g_strerror(errno));
+    exit(1);
+  }
+
+  /* a socket left behind by an earlier run would stop us binding, but
+   * anything else at the path is not ours to remove */
+  struct stat existing;
+  if (lstat(path, &existing) == 0) {
+    if (!S_ISSOCK(existing.st_mode)) {
+      g_critical("control socket path %s exists, and is not a socket", path);
+      exit(1);
+    }
+    unlink(path);
+  }
+  if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(fd, 4) < 0) {
+    g_critical("failed to listen on %s: %s", path, g_strerror(errno));
+    exit(1);
+  }
+
+  Control* control  = g_new0(Control, 1);
+  control->path     = g_strdup(path);
+  control->fd       = fd;
+  control->commands = commands;
+  control->data     = data;
+  control->clients  = g_ptr_array_new();
+  control->channel  = g_io_channel_unix_new(fd);
+  control->source   = g_io_add_watch(
+    control->channel, G_IO_IN, (GIOFunc)control_accept, control
+  );
+
+  return control;
+}
+
+void control_stop(Control* control) {
+  for (guint i = 0; i < control->clients->len; ++i)
+    control_client_free(g_ptr_array_index(control->clients, i));
+  g_ptr_array_free(control->clients, TRUE);
+
+  g_source_remove(control->source);
+  g_io_channel_unref(control->channel);
+  close(control->fd);
+  unlink(control->path);
+
+  g_free(control->path);
+  g_free(control);
+}
@@ -0,0 +1,50 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <glib.h>
+
+typedef struct Control Control;
+
+/**
+ * Carry out a command from the control socket.  Handlers run on the main
+ * loop, so they may change anything the schedulers use.  Any output is
+ * appended to reply, one line at a time; on failure, reply holds why.
+ * @param[in] args   the arguments, NULL terminated.
+ * @param[in] reply  the output to send back.
+ * @param[in] data   as given to control_start().
+ * @returns TRUE if the command was carried out.
+ */
+typedef gboolean (*ControlFunc)(gchar** args, GString* reply, gpointer data);
+
+typedef struct ControlCommand {
+  const char* name;
+  const char* usage;            /* the arguments, for "help" */
+  guint       min_args;
+  guint       max_args;
+  ControlFunc handler;
+} ControlCommand;
+
+/**
+ * Listen for commands on a Unix socket, attached to the default main loop.
+ *
+ * The protocol is a line at a time: a command name and its arguments,
+ * separated by spaces and quoted as in the shell.  Each command is answered
+ * by any output lines, then "ok" or "error: MESSAGE" on a line of its own,
+ * so it can be driven by hand with socat, or by a script.  "help" lists the
+ * commands.
+ *
+ * @param[in] path      the socket to create; any stale socket is replaced,
+ * but anything else at the path is refused.
+ * @param[in] commands  the commands, ending with one with a NULL name.
+ * @param[in] data      passed to every command handler.
+ * @returns[control_stop() frees] the control channel.
+ */
+Control* control_start(const char* path, const ControlCommand* commands, gpointer data);
+
+/**
+ * Close the control socket and every connection to it, removing the socket.
+ * @param[in] control  the control channel; freed.
+ */
+void control_stop(Control* control);
+
+#endif /* CONTROL_H */
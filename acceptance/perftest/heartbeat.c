@@ -0,0 +1,147 @@
+#include "heartbeat.h"
+#include "sources.h"
+
+#include <curl/curl.h>
+#include <stdlib.h>
+
+/* the resolution of the wheel, in milliseconds */
+#define HEARTBEAT_TICK      100
+
+/* hw_id values are locally administered MAC addresses, so they can not be
+ * mistaken for, or collide with, real nodes */
+#define HEARTBEAT_HW_ID     G_GUINT64_CONSTANT(0x020000000000)
+
+struct HeartbeatWheel {
+  TestSuite*    suite;
+  GThreadPool*  pool;
+
+  GArray**      slots;          /* guint32 node indexes due at each tick */
+  guint         size;
+  guint         current;
+  guint64       next_tick;      /* monotonic time the current slot is due */
+  guint         source;
+
+  guint*        busy;           /* bitmap: nodes with a checkin in flight */
+};
+
+/* each checkin thread keeps a handle, rather than making one per checkin */
+static GPrivate heartbeat_curl = G_PRIVATE_INIT((GDestroyNotify)curl_easy_cleanup);
+
+static void heartbeat_schedule(HeartbeatWheel* wheel, guint32 node, guint ticks) {
+  guint slot = (wheel->current + MAX(ticks, 1)) % wheel->size;
+  g_array_append_val(wheel->slots[slot], node);
+}
+
+static guint heartbeat_next_ticks(HeartbeatWheel* wheel) {
+  const Heartbeat* heartbeat = &wheel->suite->heartbeat;
+  gint  jitter   = heartbeat->jitter
+    ? g_rand_int_range(wheel->suite->rand, -(gint)heartbeat->jitter, heartbeat->jitter + 1)
+    : 0;
+  return (heartbeat->interval + jitter) / HEARTBEAT_TICK;
+}
+
+static void heartbeat_handler(gpointer data, HeartbeatWheel* wheel) {
+  const Heartbeat* heartbeat = &wheel->suite->heartbeat;
+  const guint32    node      = GPOINTER_TO_UINT(data) - 1;
+
+  CURL* curl = g_private_get(&heartbeat_curl);
+  if (!curl) {
+    curl = scenario_curl_new(wheel->suite, FALSE);
+    g_private_set(&heartbeat_curl, curl);
+  }
+
+  /* idle nodes are numbered apart from those running scenarios, which
+   * count up from zero, so that they stick to targets of their own */
+  guint  target = target_acquire(wheel->suite, G_MAXUINT - node);
+  gchar* url    = g_strdup_printf(
+    "%s%012" G_GINT64_MODIFIER "X%s",
+    heartbeat->url_prefixes[target], HEARTBEAT_HW_ID + node,
+    heartbeat->url_suffixes[target]
+  );
+  sources_attach(curl, wheel->suite, node);
+  scenario_run_once(heartbeat->part, heartbeat->event, target, url, curl, wheel->suite);
+  target_release(wheel->suite, target);
+  g_free(url);
+
+  g_atomic_int_and(&wheel->busy[node / 32], ~(1u << (node % 32)));
+}
+
+/* turn the wheel to the present, starting every node that is due */
+static gboolean heartbeat_tick(HeartbeatWheel* wheel) {
+  const guint64 now = g_get_monotonic_time();
+
+  while (wheel->next_tick <= now) {
+    GArray* due = wheel->slots[wheel->current];
+    wheel->slots[wheel->current] = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+    for (guint i = 0; i < due->len; ++i) {
+      guint32 node = g_array_index(due, guint32, i);
+      guint   bit  = 1u << (node % 32);
+
+      /* a node checks in every interval, counted from when the last checkin
+       * started; one still waiting on a slow server skips its turn, and
+       * looks again next tick */
+      if (g_atomic_int_or(&wheel->busy[node / 32], bit) & bit) {
+        heartbeat_schedule(wheel, node, 1);
+        continue;
+      }
+
+      g_thread_pool_push(wheel->pool, GUINT_TO_POINTER(node + 1), NULL);
+      heartbeat_schedule(wheel, node, heartbeat_next_ticks(wheel));
+    }
+
+    g_array_free(due, TRUE);
+    wheel->current    = (wheel->current + 1) % wheel->size;
+    wheel->next_tick += HEARTBEAT_TICK * 1000;
+  }
+
+  return TRUE;
+}
+
+HeartbeatWheel* heartbeat_start(TestSuite* suite) {
+  const Heartbeat* heartbeat = &suite->heartbeat;
+  HeartbeatWheel*  wheel     = g_new0(HeartbeatWheel, 1);
+
+  wheel->suite = suite;
+  wheel->size  = (heartbeat->interval + heartbeat->jitter) / HEARTBEAT_TICK + 2;
+  wheel->slots = g_new(GArray*, wheel->size);
+  wheel->busy  = g_new0(guint, heartbeat->nodes / 32 + 1);
+
+  /* spread the first checkins evenly over one interval, sizing each slot
+   * for its share of the population */
+  const guint spread   = MAX(heartbeat->interval / HEARTBEAT_TICK, 1);
+  const guint per_slot = heartbeat->nodes / spread + 1;
+  for (guint i = 0; i < wheel->size; ++i)
+    wheel->slots[i] = g_array_sized_new(FALSE, FALSE, sizeof(guint32), per_slot);
+
+  for (guint32 node = 0; node < heartbeat->nodes; ++node)
+    g_array_append_val(
+      wheel->slots[g_rand_int_range(suite->rand, 0, spread)], node
+    );
+
+  wheel->pool = g_thread_pool_new(
+    (GFunc)heartbeat_handler, wheel, heartbeat->concurrency, FALSE, NULL
+  );
+
+  wheel->next_tick = g_get_monotonic_time();
+  wheel->source    = g_timeout_add_full(
+    G_PRIORITY_HIGH, HEARTBEAT_TICK, (GSourceFunc)heartbeat_tick, wheel, NULL
+  );
+
+  return wheel;
+}
+
+guint heartbeat_queued(HeartbeatWheel* wheel) {
+  return g_thread_pool_unprocessed(wheel->pool);
+}
+
+void heartbeat_stop(HeartbeatWheel* wheel) {
+  g_source_remove(wheel->source);
+  g_thread_pool_free(wheel->pool, TRUE, TRUE);
+
+  for (guint i = 0; i < wheel->size; ++i)
+    g_array_free(wheel->slots[i], TRUE);
+  g_free(wheel->slots);
+  g_free(wheel->busy);
+  g_free(wheel);
+}
@@ -0,0 +1,39 @@
+#ifndef HEARTBEAT_H
+#define HEARTBEAT_H
+
+#include "scenario.h"
+
+#include <glib.h>
+
+typedef struct HeartbeatWheel HeartbeatWheel;
+
+/**
+ * Start the idle population checking in, as set by suite->heartbeat.
+ *
+ * Each node is nothing more than a 32 bit index sitting in a slot of a
+ * timing wheel, turned by the main loop, plus a bit to say a checkin is in
+ * flight; the hw_id and URL are made from the index when the node is due.
+ * That keeps a population of hundreds of thousands of nodes to a few bytes
+ * each, and the checkins are only counted, not kept, by the stats.  Checkins
+ * run on their own thread pool, so they neither wait for nor hold up the
+ * refresh scenarios.
+ *
+ * @param[in] suite  the test suite, with suite->heartbeat.nodes set.
+ * @returns[heartbeat_stop() frees] the running heartbeat.
+ */
+HeartbeatWheel* heartbeat_start(TestSuite* suite);
+
+/**
+ * Count the checkins that are due, but waiting for a thread to run on.
+ * @param[in] wheel  the running heartbeat.
+ */
+guint heartbeat_queued(HeartbeatWheel* wheel);
+
+/**
+ * Stop the idle population, dropping any queued checkins and waiting for
+ * those in flight to finish.
+ * @param[in] wheel  the running heartbeat; freed.
+ */
+void heartbeat_stop(HeartbeatWheel* wheel);
+
+#endif /* HEARTBEAT_H */
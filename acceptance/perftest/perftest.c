@@ -1,24 +1,37 @@
 #include "stats.h"
 #include "scenario.h"
+#include "replay.h"
+#include "heartbeat.h"
+#include "control.h"
+#include "sources.h"
 
 #include <glib.h>
 #include <curl/curl.h>
 #include <stdlib.h>
 #include <sysexits.h>
 #include <math.h>
+#include <stdarg.h>
 
 typedef struct ScenarioClosure {
   const char*   name;
   TestSuite*    suite;
   guint         runs;
-  Scenario*     scenario;
+  NodeClass*    klass;
+  guint         source;         /* the scheduling timer, zero if stopped */
+  gboolean      paused;
 } ScenarioClosure;
 
+typedef struct ReplayClosure {
+  TestSuite*    suite;
+  guint         next;           /* index of the next request to start */
+} ReplayClosure;
+
 typedef struct ProgressClosure {
   TestSuite*       suite;
   guint            cycle;
-  ScenarioClosure* physical;
-  ScenarioClosure* virtual;
+  GPtrArray*       schedules;   /* ScenarioClosure* */
+  ReplayClosure*   replay;
+  HeartbeatWheel*  heartbeat;   /* NULL unless the idle population checks in */
 } ProgressClosure;
 
 
@@ -28,16 +41,26 @@ static gboolean scenario_progress(ProgressClosure* closure) {
   /* turn this into a number of seconds, rounding down... */
   guint runtime = (g_get_monotonic_time() - closure->suite->start_time) / 1000000;
 
-  guint pending = closure->physical->runs + closure->virtual->runs;
+  guint pending = 0;
+  for (guint i = 0; i < closure->schedules->len; ++i)
+    pending += ((ScenarioClosure*)g_ptr_array_index(closure->schedules, i))->runs;
+  if (!g_atomic_int_get(&closure->suite->replay_stopped))
+    pending += closure->suite->replay_requests->len -
+      g_atomic_int_get(&closure->suite->replay_started);
+
   guint threads = g_thread_pool_get_num_threads(closure->suite->pool);
   guint queued  = g_thread_pool_unprocessed(closure->suite->pool);
 
   g_print(
-    "after %4d second%s %3d to be scheduled, %3d running, %3d queued\n",
+    "after %4d second%s %3d to be scheduled, %3d running, %3d queued",
     runtime, runtime == 1 ? ": " : "s:", pending, threads, queued
   );
+  if (closure->heartbeat)
+    g_print(", %3d heartbeats queued", heartbeat_queued(closure->heartbeat));
+  g_print("\n");
 
   stats_report_concurrency(closure->suite->stats, pending, threads, queued);
+  stats_sample_sockets(closure->suite->stats);
 
   /* now, work out if we are actually *finished* our simulation... */
   if (pending == 0 && threads == 0 && queued == 0)
@@ -47,8 +70,8 @@ static gboolean scenario_progress(ProgressClosure* closure) {
   if (closure->cycle > closure->suite->max_cycles) {
     g_print("ERROR: ran for more than %d seconds, aborting!\n",
             closure->suite->max_cycles);
-    g_thread_pool_free(closure->suite->pool, TRUE, FALSE);
-    g_print("...finished aborting all threads.\n");
+    /* transfers in flight give up, and their scenarios stop; main() waits */
+    g_atomic_int_set(&closure->suite->aborting, 1);
     g_main_loop_quit(closure->suite->loop);
   }
 
@@ -58,10 +81,8 @@ static gboolean scenario_progress(ProgressClosure* closure) {
 static gboolean scenario_scheduler(ScenarioClosure* closure) {
   /* schedule another operation to pool, if needed */
   if (closure->runs > 0) {
-    /** @todo danielp 2012-10-10: this needs to assign more than the basic
-     * scenario, and to balance load over phys/virt machines.
-     */
-    g_thread_pool_push(closure->suite->pool, closure->scenario, NULL);
+    Scenario* scenario = node_class_pick_scenario(closure->klass, closure->suite);
+    g_thread_pool_push(closure->suite->pool, scenario, NULL);
 
     closure->runs = closure->runs - 1;
   }
@@ -69,81 +90,426 @@ static gboolean scenario_scheduler(ScenarioClosure* closure) {
   return TRUE;
 }
 
+/* (re)start the timer for a schedule, at the current rate of its class */
+static void schedule_start(ScenarioClosure* schedule) {
+  if (schedule->source)
+    g_source_remove(schedule->source);
+
+  schedule->source = g_timeout_add_full(
+    G_PRIORITY_HIGH, floor(1000.0 / schedule->klass->refreshes_per_second),
+    (GSourceFunc)scenario_scheduler, schedule, NULL
+  );
+}
+
+static void schedule_stop(ScenarioClosure* schedule) {
+  if (schedule->source)
+    g_source_remove(schedule->source);
+  schedule->source = 0;
+}
+
+static gboolean replay_scheduler(ReplayClosure* closure) {
+  TestSuite* suite    = closure->suite;
+  GArray*    requests = suite->replay_requests;
+  guint64    elapsed  = g_get_monotonic_time() - suite->start_time;
+
+  /* every request that is due starts, unless its node is still waiting on
+   * the one before; flat out, that is all of them, and the pool size limits
+   * how many nodes run at once */
+  while (closure->next < requests->len) {
+    ReplayRequest* request = &g_array_index(requests, ReplayRequest, closure->next);
+    if (suite->replay_speed > 0 && request->offset / suite->replay_speed > elapsed)
+      break;
+
+    replay_due(request, suite);
+    closure->next += 1;
+  }
+
+  return TRUE;
+}
+
+
+/**************************************************************************
+ * Control commands, which run on the main loop with the progress closure
+ */
+
+/* the schedules a command applies to: one class by name, or "all" of them */
+static GPtrArray* control_schedules(
+  ProgressClosure* run, const char* name, GString* reply
+) {
+  GPtrArray* found = g_ptr_array_new();
+  for (guint i = 0; i < run->schedules->len; ++i) {
+    ScenarioClosure* schedule = g_ptr_array_index(run->schedules, i);
+    if (!name || g_strcmp0(name, "all") == 0 || g_strcmp0(name, schedule->name) == 0)
+      g_ptr_array_add(found, schedule);
+  }
+
+  if (found->len == 0) {
+    g_string_append_printf(reply, "no node class %s", name ? name : "is scheduled");
+    g_ptr_array_free(found, TRUE);
+    return NULL;
+  }
+
+  return found;
+}
+
+static gboolean control_parse_rate(const char* text, double* value, GString* reply) {
+  gchar* end = NULL;
+  *value = g_ascii_strtod(text, &end);
+  if (!end || *end || *value <= 0) {
+    g_string_append_printf(reply, "%s is not a positive number", text);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static void control_marker(ProgressClosure* run, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  gchar* text = g_strdup_vprintf(format, args);
+  va_end(args);
+
+  stats_report_marker(run->suite->stats, text);
+  g_print("control: %s\n", text);
+  g_free(text);
+}
+
+static gboolean control_status(gchar** args, GString* reply, ProgressClosure* run) {
+  TestSuite* suite   = run->suite;
+  guint      runtime = (g_get_monotonic_time() - suite->start_time) / 1000000;
+
+  g_string_append_printf(reply, "running for %d seconds\n", runtime);
+  for (guint i = 0; i < run->schedules->len; ++i) {
+    ScenarioClosure* schedule = g_ptr_array_index(run->schedules, i);
+    NodeClass*       klass    = schedule->klass;
+    g_string_append_printf(
+      reply, "class %s: %s, %.2f refreshes per second, %d to schedule, mix",
+      schedule->name, schedule->paused ? "paused" : "running",
+      klass->refreshes_per_second, schedule->runs
+    );
+    for (guint j = 0; j < klass->scenarios->len; ++j) {
+      guint weight = g_array_index(klass->weights, guint, j) -
+        (j ? g_array_index(klass->weights, guint, j - 1) : 0);
+      g_string_append_printf(
+        reply, "%s %s:%d", j == 0 ? "" : ",",
+        ((Scenario*)g_ptr_array_index(klass->scenarios, j))->name, weight
+      );
+    }
+    g_string_append_c(reply, '\n');
+  }
+
+  if (suite->replay->len > 0)
+    g_string_append_printf(reply, "replay: %d of %d requests started\n",
+                           g_atomic_int_get(&suite->replay_started),
+                           suite->replay_requests->len);
+
+  g_string_append_printf(reply, "scenarios: %d running, %d queued\n",
+                         g_thread_pool_get_num_threads(suite->pool),
+                         g_thread_pool_unprocessed(suite->pool));
+  if (run->heartbeat)
+    g_string_append_printf(reply, "heartbeats: %d queued\n",
+                           heartbeat_queued(run->heartbeat));
+
+  for (guint i = 0; i < suite->targets->len; ++i) {
+    Target* target = g_ptr_array_index(suite->targets, i);
+    if (target->name)
+      g_string_append_printf(reply, "target %s: %d in flight\n", target->name,
+                             g_atomic_int_get(&target->outstanding));
+  }
+  return TRUE;
+}
+
+static gboolean control_rate(gchar** args, GString* reply, ProgressClosure* run) {
+  double     rate;
+  GPtrArray* schedules = control_schedules(run, args[0], reply);
+  if (!schedules || !control_parse_rate(args[1], &rate, reply)) {
+    if (schedules)
+      g_ptr_array_free(schedules, TRUE);
+    return FALSE;
+  }
+
+  for (guint i = 0; i < schedules->len; ++i) {
+    ScenarioClosure* schedule = g_ptr_array_index(schedules, i);
+    schedule->klass->refreshes_per_second = rate;
+    if (!schedule->paused)
+      schedule_start(schedule);
+  }
+
+  control_marker(run, "rate %s %.2f per second", args[0], rate);
+  g_ptr_array_free(schedules, TRUE);
+  return TRUE;
+}
+
+static gboolean control_scale(gchar** args, GString* reply, ProgressClosure* run) {
+  double factor;
+  if (!control_parse_rate(args[0], &factor, reply))
+    return FALSE;
+
+  for (guint i = 0; i < run->schedules->len; ++i) {
+    ScenarioClosure* schedule = g_ptr_array_index(run->schedules, i);
+    schedule->klass->refreshes_per_second *= factor;
+    if (!schedule->paused)
+      schedule_start(schedule);
+  }
+
+  control_marker(run, "scale rates by %.2f", factor);
+  return TRUE;
+}
+
+static gboolean control_pause(gchar** args, GString* reply, ProgressClosure* run) {
+  GPtrArray* schedules = control_schedules(run, args[0], reply);
+  if (!schedules)
+    return FALSE;
+
+  for (guint i = 0; i < schedules->len; ++i) {
+    ScenarioClosure* schedule = g_ptr_array_index(schedules, i);
+    schedule_stop(schedule);
+    schedule->paused = TRUE;
+  }
+
+  control_marker(run, "pause %s", args[0] ? args[0] : "all");
+  g_ptr_array_free(schedules, TRUE);
+  return TRUE;
+}
+
+static gboolean control_resume(gchar** args, GString* reply, ProgressClosure* run) {
+  GPtrArray* schedules = control_schedules(run, args[0], reply);
+  if (!schedules)
+    return FALSE;
+
+  for (guint i = 0; i < schedules->len; ++i) {
+    ScenarioClosure* schedule = g_ptr_array_index(schedules, i);
+    if (schedule->paused && schedule->runs > 0)
+      schedule_start(schedule);
+    schedule->paused = FALSE;
+  }
+
+  control_marker(run, "resume %s", args[0] ? args[0] : "all");
+  g_ptr_array_free(schedules, TRUE);
+  return TRUE;
+}
+
+static gboolean control_mix(gchar** args, GString* reply, ProgressClosure* run) {
+  GPtrArray* schedules = control_schedules(run, args[0], reply);
+  if (!schedules)
+    return FALSE;
+
+  for (guint i = 0; i < schedules->len; ++i) {
+    ScenarioClosure* schedule = g_ptr_array_index(schedules, i);
+    gchar*           problem  = node_class_set_mix(schedule->klass, run->suite, args + 1);
+    if (problem) {
+      g_string_append_printf(reply, "%s %s", schedule->name, problem);
+      g_free(problem);
+      g_ptr_array_free(schedules, TRUE);
+      return FALSE;
+    }
+  }
+
+  gchar* mix = g_strjoinv(" ", args + 1);
+  control_marker(run, "mix %s %s", args[0], mix);
+  g_free(mix);
+  g_ptr_array_free(schedules, TRUE);
+  return TRUE;
+}
+
+static gboolean control_snapshot(gchar** args, GString* reply, ProgressClosure* run) {
+  guint  runtime = (g_get_monotonic_time() - run->suite->start_time) / 1000000;
+  gchar* dirname = args[0] ? g_strdup(args[0]) : g_strdup_printf("snapshot-%d", runtime);
+
+  control_marker(run, "snapshot %s", dirname);
+  stats_snapshot(run->suite->stats, dirname);
+
+  g_string_append_printf(reply, "writing %s\n", dirname);
+  g_free(dirname);
+  return TRUE;
+}
+
+static gboolean control_stop_run(gchar** args, GString* reply, ProgressClosure* run) {
+  for (guint i = 0; i < run->schedules->len; ++i) {
+    ScenarioClosure* schedule = g_ptr_array_index(run->schedules, i);
+    schedule_stop(schedule);
+    schedule->runs = 0;
+  }
+  run->replay->next = run->suite->replay_requests->len;
+  g_atomic_int_set(&run->suite->replay_stopped, 1);
+
+  /* the run ends as usual once the scenarios already started finish */
+  control_marker(run, "stop scheduling");
+  return TRUE;
+}
+
+static const ControlCommand control_commands[] = {
+  { "status",   "",                    0, 0, (ControlFunc)control_status   },
+  { "rate",     "CLASS|all PER-SECOND", 2, 2, (ControlFunc)control_rate     },
+  { "scale",    "FACTOR",              1, 1, (ControlFunc)control_scale    },
+  { "pause",    "[CLASS|all]",         0, 1, (ControlFunc)control_pause    },
+  { "resume",   "[CLASS|all]",         0, 1, (ControlFunc)control_resume   },
+  { "mix",      "CLASS|all SCENARIO:WEIGHT...",
+                                       2, G_MAXUINT, (ControlFunc)control_mix },
+  { "snapshot", "[DIRECTORY]",         0, 1, (ControlFunc)control_snapshot },
+  { "stop",     "",                    0, 0, (ControlFunc)control_stop_run },
+  { NULL }
+};
+
 
 int main(int argc, char* argv[]) {
   curl_global_init(CURL_GLOBAL_ALL);
   TestSuite* suite = test_suite_setup(&argc, &argv);
 
+  if (suite->report_benchmark) {
+    stats_benchmark_report(suite->stats, suite->report_benchmark);
+    return 0;
+  }
+
   /* the worker pool has unlimited size, but uses shared threads to allow for
    * an unlimited number of overlapping operations during the scenario - since
    * we are modelling performance based on arrival rate, not on active
-   * node count.
+   * node count.  A replay runs single requests, rather than scenarios.
    */
   suite->pool = g_thread_pool_new(
-    (GFunc)scenario_handler, suite, -1, FALSE, NULL
+    suite->replay->len > 0 ? (GFunc)replay_handler : (GFunc)scenario_handler,
+    suite, -1, FALSE, NULL
   );
 
   /* ...and the main loop that handles scheduling and exiting. */
   suite->loop = g_main_loop_new(NULL, FALSE);
 
-  /* start our scenario scheduler */
-  ScenarioClosure physical_closure = {
-    .name      = "physical refresh",
-    .suite     = suite,
-    .runs      = suite->physical_refresh_events,
-    .scenario  = suite->esxi
-  };
+  /* a replay is scheduled by the log timeline, not by node class */
+  ReplayClosure replay = { .suite = suite, .next = 0 };
+  if (suite->replay->len > 0) {
+    if (suite->replay_speed > 0) {
+      g_print(
+        "Replaying %d node%s at %.2fx for approximately %d second%s\n",
+        suite->replay->len, suite->replay->len == 1 ? "" : "s",
+        suite->replay_speed,
+        suite->approximate_runtime, suite->approximate_runtime == 1 ? "" : "s"
+      );
+    } else {
+      g_thread_pool_set_max_threads(suite->pool, suite->replay_concurrency, NULL);
+      g_print(
+        "Replaying %d node%s as fast as possible, %d at a time\n",
+        suite->replay->len, suite->replay->len == 1 ? "" : "s",
+        suite->replay_concurrency
+      );
+    }
 
-  ScenarioClosure virtual_closure = {
-    .name    = "virtual refresh",
-    .suite   = suite,
-    .runs    = suite->virtual_refresh_events,
-    /** @todo danielp 2012-10-11: this should have more than one scenario... */
-    .scenario = suite->ubuntu
-  };
+    g_timeout_add_full(
+      G_PRIORITY_HIGH, 10, (GSourceFunc)replay_scheduler, &replay, NULL
+    );
+  }
 
-  g_print(
-    "Testing will run for %d second%s performing scheduling\n"
-    "  with %4d (simulated) physical refresh%s\n"
-    "  and  %4d (simulated) virtual refresh%s\n"
-    "  total rate approximately %.2f refreshes per second\n"
-    "  for a maximum of %d seconds\n",
-    suite->approximate_runtime, suite->approximate_runtime == 1 ? "" : "s",
-    physical_closure.runs, physical_closure.runs == 1 ? "" : "es",
-    virtual_closure.runs,  virtual_closure.runs  == 1 ? "" : "es",
-    suite->physical_refreshes_per_second + suite->virtual_refreshes_per_second,
-    suite->max_cycles
-  );
+  /* start our scenario schedulers, one per class of node */
+  GPtrArray* schedules = g_ptr_array_new_with_free_func(g_free);
+  for (guint i = 0; i < suite->classes->len; ++i) {
+    NodeClass*       klass    = g_ptr_array_index(suite->classes, i);
+    ScenarioClosure* schedule = g_new0(ScenarioClosure, 1);
+    schedule->name  = klass->name;
+    schedule->suite = suite;
+    schedule->runs  = klass->refresh_events;
+    schedule->klass = klass;
+    g_ptr_array_add(schedules, schedule);
+  }
 
-  g_timeout_add_full(
-    G_PRIORITY_HIGH, floor(1000.0 / suite->physical_refreshes_per_second),
-    (GSourceFunc)scenario_scheduler, &physical_closure, NULL
-  );
+  if (schedules->len > 0) {
+    g_print(
+      "Testing will run for %d second%s performing scheduling\n",
+      suite->approximate_runtime, suite->approximate_runtime == 1 ? "" : "s"
+    );
+  }
 
-  g_timeout_add_full(
-    G_PRIORITY_HIGH, floor(1000.0 / suite->virtual_refreshes_per_second),
-    (GSourceFunc)scenario_scheduler, &virtual_closure, NULL
-  );
+  for (guint i = 0; i < schedules->len; ++i) {
+    ScenarioClosure* schedule = g_ptr_array_index(schedules, i);
+    g_print(
+      "  %s %4d (simulated) %s refresh%s at %.2f per second, running",
+      i == 0 ? "with" : "and ", schedule->runs, schedule->name,
+      schedule->runs == 1 ? "" : "es", schedule->klass->refreshes_per_second
+    );
+
+    for (guint j = 0; j < schedule->klass->scenarios->len; ++j) {
+      Scenario* scenario = g_ptr_array_index(schedule->klass->scenarios, j);
+      guint     weight   = g_array_index(schedule->klass->weights, guint, j) -
+        (j ? g_array_index(schedule->klass->weights, guint, j - 1) : 0);
+      g_print(
+        "%s %s %.0f%%", j == 0 ? "" : ",", scenario->name,
+        100.0 * weight / schedule->klass->total_weight
+      );
+    }
+    g_print("\n");
+  }
+
+  if (schedules->len > 0) {
+    g_print(
+      "  total rate approximately %.2f refreshes per second\n",
+      suite->refreshes_per_second
+    );
+  }
+  const Heartbeat* heartbeat = &suite->heartbeat;
+  if (heartbeat->nodes > 0) {
+    g_print(
+      "  over %d idle node%s checking in every %.1f seconds (+/- %.1f), %d at a time\n",
+      heartbeat->nodes, heartbeat->nodes == 1 ? "" : "s",
+      heartbeat->interval / 1000.0, heartbeat->jitter / 1000.0,
+      heartbeat->concurrency
+    );
+  }
+  if (suite->targets->len > 1) {
+    static const char* policies[] = {
+      [TARGET_STICKY]            = "each node sticking to one",
+      [TARGET_ROUND_ROBIN]       = "round robin",
+      [TARGET_LEAST_OUTSTANDING] = "to the least outstanding"
+    };
+    g_print("  shared between %d targets, %s\n",
+            suite->targets->len, policies[suite->target_policy]);
+  }
+  if (suite->sources->len > 0)
+    g_print("  from %d source address%s, each with %d ephemeral ports\n",
+            suite->sources->len, suite->sources->len == 1 ? "" : "es",
+            sources_port_range());
+  g_print("  for a maximum of %d seconds\n", suite->max_cycles);
+
+  for (guint i = 0; i < schedules->len; ++i)
+    schedule_start(g_ptr_array_index(schedules, i));
 
   ProgressClosure progress = {
     .suite       = suite,
     .cycle       = 0,
-    .physical    = &physical_closure,
-    .virtual     = &virtual_closure
+    .schedules   = schedules,
+    .replay      = &replay,
+    .heartbeat   = NULL
   };
   g_timeout_add_seconds(1, (GSourceFunc)scenario_progress, &progress);
 
+  Control* control = NULL;
+  if (suite->control) {
+    control = control_start(suite->control, control_commands, &progress);
+    g_print("Accepting commands on %s\n", suite->control);
+  }
+
   suite->start_time = g_get_monotonic_time();
 
-  /* submit the first event on both schedules at time zero */
-  scenario_scheduler(&physical_closure);
-  scenario_scheduler(&virtual_closure);
+  /* submit the first event on every schedule at time zero */
+  g_ptr_array_foreach(schedules, (GFunc)scenario_scheduler, NULL);
+  replay_scheduler(&replay);
+
+  /* the idle population checks in underneath everything else */
+  if (heartbeat->nodes > 0)
+    progress.heartbeat = heartbeat_start(suite);
 
   /* ...and allow the scheduler to run the rest. */
   g_main_loop_run(suite->loop);
 
   suite->end_time  = g_get_monotonic_time();
 
+  /* every scenario still running reports to the stats, so they must all
+   * be done before the report; those not yet started never will be */
+  g_thread_pool_free(suite->pool, TRUE, TRUE);
+  if (g_atomic_int_get(&suite->aborting))
+    g_print("...finished aborting all threads.\n");
+
+  if (progress.heartbeat)
+    heartbeat_stop(progress.heartbeat);
+  if (control)
+    control_stop(control);
+
   stats_print_report(suite->stats);
 
   return 0;
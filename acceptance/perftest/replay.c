@@ -0,0 +1,370 @@
+#include "replay.h"
+#include "sources.h"
+
+#include <glib.h>
+#include <curl/curl.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the access log has no port, so route by path to the Razor services */
+#define API_PORT    8026
+#define IMAGE_PORT  8027
+
+typedef struct ReplayLine {
+  const char* client;
+  gsize       client_len;
+  const char* method;
+  gsize       method_len;
+  const char* path;
+  gsize       path_len;
+  gint64      when;             /* microseconds since the epoch */
+} ReplayLine;
+
+/** per-node state, only needed while loading */
+typedef struct ReplayNode {
+  Scenario*     scenario;
+  ScenarioPart* part;
+  guint         index;          /* in suite->replay */
+} ReplayNode;
+
+static const char* months[] = {
+  "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+  "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+/* days since 1970-01-01 in the proleptic Gregorian calendar, since C99 has no
+ * portable timegm() */
+static gint64 days_from_civil(gint64 year, guint month, guint day) {
+  year -= month <= 2;
+  const gint64 era = (year >= 0 ? year : year - 399) / 400;
+  const guint  yoe = year - era * 400;
+  const guint  doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  const guint  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+static gboolean parse_digits(const char** p, const char* end, guint count, guint* value) {
+  *value = 0;
+  for (guint i = 0; i < count; ++i, ++*p) {
+    if (*p >= end || !g_ascii_isdigit(**p))
+      return FALSE;
+    *value = *value * 10 + (**p - '0');
+  }
+  return TRUE;
+}
+
+static gboolean expect_char(const char** p, const char* end, char c) {
+  if (*p >= end || **p != c)
+    return FALSE;
+  ++*p;
+  return TRUE;
+}
+
+static gboolean method_is(const ReplayLine* line, const char* method) {
+  return line->method_len == strlen(method) &&
+    strncmp(line->method, method, line->method_len) == 0;
+}
+
+/* each replay thread keeps a handle, rather than making one per request */
+static GPrivate replay_curl = G_PRIVATE_INIT((GDestroyNotify)curl_easy_cleanup);
+
+/* by time, then in the order of the log */
+static gint compare_request(gconstpointer a, gconstpointer b) {
+  const ReplayRequest* x = a;
+  const ReplayRequest* y = b;
+  if (x->offset != y->offset)
+    return x->offset < y->offset ? -1 : 1;
+  if (x->node != y->node)
+    return x->node < y->node ? -1 : 1;
+  return x->event < y->event ? -1 : (x->event > y->event ? 1 : 0);
+}
+
+static gboolean parse_month(const char** p, const char* end, guint* month) {
+  if (end - *p < 3)
+    return FALSE;
+  for (*month = 0; *month < 12; ++*month)
+    if (strncmp(*p, months[*month], 3) == 0)
+      break;
+  if (*month == 12)
+    return FALSE;
+  *p += 3;
+  return TRUE;
+}
+
+/* "10/Oct/2000:13:55:36 -0700", with optional fractional seconds after the
+ * seconds field, as some front ends will log. */
+static gboolean parse_clf_time(const char* p, const char* end, gint64* when) {
+  guint day, month, year, hour, minute, second, zh, zm;
+  guint64 fraction = 0, scale = 1000000;
+
+  if (!parse_digits(&p, end, 2, &day) || !expect_char(&p, end, '/') ||
+      !parse_month(&p, end, &month))
+    return FALSE;
+
+  if (!expect_char(&p, end, '/') ||
+      !parse_digits(&p, end, 4, &year)   || !expect_char(&p, end, ':') ||
+      !parse_digits(&p, end, 2, &hour)   || !expect_char(&p, end, ':') ||
+      !parse_digits(&p, end, 2, &minute) || !expect_char(&p, end, ':') ||
+      !parse_digits(&p, end, 2, &second))
+    return FALSE;
+
+  if (p < end && *p == '.') {
+    for (++p; p < end && g_ascii_isdigit(*p); ++p) {
+      if (scale > 1) {
+        scale    /= 10;
+        fraction += (*p - '0') * scale;
+      }
+    }
+  }
+
+  if (!expect_char(&p, end, ' ') || p >= end || (*p != '+' && *p != '-'))
+    return FALSE;
+  gint sign = *p++ == '-' ? -1 : 1;
+  if (!parse_digits(&p, end, 2, &zh) || !parse_digits(&p, end, 2, &zm))
+    return FALSE;
+
+  gint64 seconds = days_from_civil(year, month + 1, day) * 86400 +
+    hour * 3600 + minute * 60 + second - sign * (gint64)(zh * 3600 + zm * 60);
+
+  *when = seconds * 1000000 + fraction;
+  return TRUE;
+}
+
+/* "Tue, 10 Oct 2000 20:55:36 GMT", from toUTCString(), as the default format
+ * of the connect and express logger writes :date */
+static gboolean parse_rfc1123_time(const char* p, const char* end, gint64* when) {
+  guint day, month, year, hour, minute, second;
+
+  const char* comma = memchr(p, ',', end - p);
+  if (!comma)
+    return FALSE;
+  p = comma + 1;
+
+  if (!expect_char(&p, end, ' ') || !parse_digits(&p, end, 2, &day) ||
+      !expect_char(&p, end, ' ') || !parse_month(&p, end, &month) ||
+      !expect_char(&p, end, ' ') ||
+      !parse_digits(&p, end, 4, &year)   || !expect_char(&p, end, ' ') ||
+      !parse_digits(&p, end, 2, &hour)   || !expect_char(&p, end, ':') ||
+      !parse_digits(&p, end, 2, &minute) || !expect_char(&p, end, ':') ||
+      !parse_digits(&p, end, 2, &second))
+    return FALSE;
+
+  if (end - p != 4 || strncmp(p, " GMT", 4) != 0)
+    return FALSE;
+
+  gint64 seconds = days_from_civil(year, month + 1, day) * 86400 +
+    hour * 3600 + minute * 60 + second;
+
+  *when = seconds * 1000000;
+  return TRUE;
+}
+
+/* client ident user [time] "METHOD path protocol" status bytes ... */
+static gboolean parse_line(const char* line, const char* end, ReplayLine* out) {
+  const char* space = memchr(line, ' ', end - line);
+  if (!space || space == line)
+    return FALSE;
+  out->client     = line;
+  out->client_len = space - line;
+
+  const char* open  = memchr(space, '[', end - space);
+  const char* close = open ? memchr(open, ']', end - open) : NULL;
+  if (!close || !(parse_clf_time(open + 1, close, &out->when) ||
+                  parse_rfc1123_time(open + 1, close, &out->when)))
+    return FALSE;
+
+  const char* request = memchr(close, '"', end - close);
+  if (!request)
+    return FALSE;
+  request += 1;
+
+  const char* quote = memchr(request, '"', end - request);
+  if (!quote)
+    return FALSE;
+
+  const char* method_end = memchr(request, ' ', quote - request);
+  if (!method_end)
+    return FALSE;
+  out->method     = request;
+  out->method_len = method_end - request;
+
+  out->path = method_end + 1;
+  const char* path_end = memchr(out->path, ' ', quote - out->path);
+  out->path_len = (path_end ? path_end : quote) - out->path;
+
+  return out->path_len > 0 && out->path[0] == '/';
+}
+
+
+void replay_load(TestSuite* suite, const char* filename) {
+  if (!((Target*)g_ptr_array_index(suite->targets, 0))->name) {
+    g_critical("a --target is required to replay %s", filename);
+    exit(1);
+  }
+
+  GError*      error  = NULL;
+  GMappedFile* mapped = g_mapped_file_new(filename, FALSE, &error);
+  if (!mapped) {
+    g_critical("failed to map %s: %s", filename, error->message);
+    exit(1);
+  }
+
+  /* client address => ReplayNode */
+  GHashTable*   nodes = g_hash_table_new_full(
+    g_str_hash, g_str_equal, g_free, g_free
+  );
+
+  const char* data     = g_mapped_file_get_contents(mapped);
+  const char* end      = data + g_mapped_file_get_length(mapped);
+  guint       lines    = 0;
+  guint       requests = 0;
+  guint       skipped  = 0;
+  gint64      earliest = G_MAXINT64;
+  gint64      latest   = G_MININT64;
+  GString*    url      = g_string_new("");
+
+  for (const char* line = data; line < end; ) {
+    const char* eol  = memchr(line, '\n', end - line);
+    const char* next = eol ? eol + 1 : end;
+    if (!eol)
+      eol = end;
+
+    ReplayLine parsed;
+    lines += 1;
+
+    /* nothing but GET can be replayed, since logs lack the request body */
+    if (!parse_line(line, eol, &parsed) ||
+        !(method_is(&parsed, "GET") || method_is(&parsed, "HEAD"))) {
+      skipped += 1;
+      line = next;
+      continue;
+    }
+
+    gchar*      client = g_strndup(parsed.client, parsed.client_len);
+    ReplayNode* node   = g_hash_table_lookup(nodes, client);
+    if (!node) {
+      node = g_new0(ReplayNode, 1);
+      node->scenario = g_new0(Scenario, 1);
+      node->part     = g_new0(ScenarioPart, 1);
+
+      /* every node has the same names, so that stats are not split a
+       * thousand ways by client address */
+      node->scenario->name  = "replay";
+      node->scenario->parts = g_list_append(NULL, node->part);
+      node->part->scenario  = node->scenario;
+      node->part->name      = "replay";
+      node->part->events    = g_ptr_array_new();
+      node->index           = suite->replay->len;
+
+      g_hash_table_insert(nodes, client, node);
+      g_ptr_array_add(suite->replay, node->scenario);
+    } else {
+      g_free(client);
+    }
+
+    const gboolean image = parsed.path_len >= strlen("/razor/image/") &&
+      strncmp(parsed.path, "/razor/image/", strlen("/razor/image/")) == 0;
+
+    Event* event          = g_new0(Event, 1);
+    event->method         = method_is(&parsed, "HEAD") ? "HEAD" : NULL;
+    event->expect_success = TRUE;
+
+    for (guint t = 0; t < suite->targets->len; ++t) {
+      Target* target = g_ptr_array_index(suite->targets, t);
+      g_string_printf(url, "http://%s:%d", target->name, image ? IMAGE_PORT : API_PORT);
+      g_string_append_len(url, parsed.path, parsed.path_len);
+      event_set_url(event, t, url->str);
+    }
+
+    /* the time of the line for now, made relative once the start is known */
+    ReplayRequest request = {
+      .offset = parsed.when,
+      .node   = node->index,
+      .event  = node->part->events->len
+    };
+    g_array_append_val(suite->replay_requests, request);
+    g_ptr_array_add(node->part->events, event);
+
+    earliest  = MIN(earliest, parsed.when);
+    latest    = MAX(latest, parsed.when);
+    requests += 1;
+
+    line = next;
+  }
+
+  /* now we know when the log starts, place every line on the timeline; logs
+   * are not always strictly ordered, so that takes a sort */
+  for (guint i = 0; i < suite->replay_requests->len; ++i)
+    g_array_index(suite->replay_requests, ReplayRequest, i).offset -= earliest;
+  g_array_sort(suite->replay_requests, compare_request);
+
+  /* chain the requests of each node together, in the order they run */
+  guint* last = g_new(guint, suite->replay->len);
+  for (guint i = 0; i < suite->replay->len; ++i)
+    last[i] = G_MAXUINT;
+  for (guint i = 0; i < suite->replay_requests->len; ++i) {
+    ReplayRequest* request = &g_array_index(suite->replay_requests, ReplayRequest, i);
+    request->next    = G_MAXUINT;
+    request->waiting = last[request->node] == G_MAXUINT ? 1 : 2;
+    if (last[request->node] != G_MAXUINT)
+      g_array_index(suite->replay_requests, ReplayRequest, last[request->node]).next = i;
+    last[request->node] = i;
+  }
+  g_free(last);
+
+  g_print(
+    "Loaded %d request%s for %d node%s from %s, spanning %.1f seconds\n"
+    "  (skipped %d of %d lines that could not be replayed)\n",
+    requests, requests == 1 ? "" : "s",
+    suite->replay->len, suite->replay->len == 1 ? "" : "s", filename,
+    requests ? (double)(latest - earliest) / 1000000 : 0.0,
+    skipped, lines
+  );
+
+  if (requests == 0) {
+    g_critical("%s: nothing to replay", filename);
+    exit(1);
+  }
+
+  suite->approximate_runtime = suite->replay_speed > 0
+    ? (latest - earliest) / 1000000 / suite->replay_speed : 0;
+
+  g_hash_table_unref(nodes);
+  g_string_free(url, TRUE);
+  g_mapped_file_unref(mapped);
+}
+
+/* whichever of being due and the previous request finishing happens last
+ * starts the request */
+void replay_due(ReplayRequest* request, TestSuite* suite) {
+  if (!g_atomic_int_dec_and_test(&request->waiting))
+    return;
+  if (g_atomic_int_get(&suite->replay_stopped) || g_atomic_int_get(&suite->aborting))
+    return;
+
+  g_atomic_int_inc(&suite->replay_started);
+  g_thread_pool_push(suite->pool, request, NULL);
+}
+
+void replay_handler(ReplayRequest* request, TestSuite* suite) {
+  const Scenario*     node  = g_ptr_array_index(suite->replay, request->node);
+  const ScenarioPart* part  = node->parts->data;
+  const Event*        event = g_ptr_array_index(part->events, request->event);
+
+  /* the clients in a log are all different machines, so every request gets
+   * a connection of its own, from the source address of its client */
+  CURL* curl = g_private_get(&replay_curl);
+  if (!curl) {
+    curl = scenario_curl_new(suite, FALSE);
+    g_private_set(&replay_curl, curl);
+  }
+
+  sources_attach(curl, suite, request->node);
+  scenario_run_request(part, event, request->node, curl, suite);
+
+  /* the node's next request starts now, if it is already due */
+  if (request->next != G_MAXUINT)
+    replay_due(
+      &g_array_index(suite->replay_requests, ReplayRequest, request->next), suite
+    );
+}
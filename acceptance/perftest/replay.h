@@ -0,0 +1,51 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "scenario.h"
+
+#include <glib.h>
+
+/**
+ * Load an access log for replay against the suite targets.
+ *
+ * The log is read in Common or Combined Log Format - as written by the
+ * express logger, nginx, or apache in front of the Razor services - through
+ * a memory mapping, one line at a time.  The time may be in the CLF format,
+ * or the RFC 1123 one that the express logger writes by default.  The
+ * services' own console output, such as the "Image requested:" lines of
+ * image_svc.js, has no time or client, so the logger must be enabled in
+ * api.js and image_svc.js, or the front end's log used instead.
+ *
+ * Each client address becomes a simulated node, with a scenario holding its
+ * requests, and every line is placed on the timeline of the log in
+ * suite->replay_requests, for the main loop to start when it falls due.  The
+ * requests of each node are chained together, so that a node makes them one
+ * at a time, in order.
+ *
+ * @param[in] suite     the test suite; suite->replay and
+ * suite->replay_requests are filled in.
+ * @param[in] filename  the access log to load.
+ */
+void replay_load(TestSuite* suite, const char* filename);
+
+/**
+ * Note that a request has fallen due on the timeline of the log.  It is
+ * pushed to suite->pool now if its node has nothing in flight, or else as
+ * soon as the node's previous request finishes.
+ *
+ * @param[in] request  the request, from suite->replay_requests.
+ * @param[in] suite    the test suite.
+ */
+void replay_due(ReplayRequest* request, TestSuite* suite);
+
+/**
+ * Make one request of a replay, with retries as the service policy says,
+ * as a thread pool function, then start the node's next request if it is
+ * already due.  Nothing waits on a worker thread.
+ *
+ * @param[in] request  the request to make, from suite->replay_requests.
+ * @param[in] suite    the test suite.
+ */
+void replay_handler(ReplayRequest* request, TestSuite* suite);
+
+#endif /* REPLAY_H */
@@ -1,23 +1,53 @@
 #include "scenario.h"
 #include "stats.h"
+#include "replay.h"
+#include "sources.h"
 #include <curl/curl.h>
+#include <uriparser/Uri.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+
+/* the longest a node sleeps before checking whether the run was aborted,
+ * in microseconds */
+#define SCENARIO_SLEEP_SLICE  100000
 
 static char*  target                   = NULL;
+static char*  target_policy            = "sticky";
+static char*  source                   = NULL;
 static char*  esxi_uuid                = NULL;
 static char*  ubuntu_uuid              = NULL;
 static char*  mk_uuid                  = NULL;
 static guint  load                     = 30;
 static guint  population               = 20000;
 static guint  max_cycles               = 600;
-static double physical_refresh_percent = 0.025; /* 2.5 percent per day */
-static double virtual_refresh_percent  = 0.200; /* 20 percent per day */
-static guint  virtual_per_physical     = 20;    /* VM multiplier */
+static char*  manifest                 = "default.manifest";
+static char** defines                  = NULL;
+static guint  warmup_seconds           = 0;
+static guint  warmup_requests          = 0;
+static gboolean steady_state           = FALSE;
+static guint  steady_window            = 10;
+static double steady_tolerance         = 0.10;
+static char*  replay                   = NULL;
+static double replay_speed             = 1.0;
+static guint  replay_concurrency       = 64;
+static guint  connect_timeout          = 0;
+static guint  timeout                  = 0;
+static char*  control                  = NULL;
+static double trace_rate               = 1.0;
+static guint  trace_limit              = 0;
+static double trace_slow               = 99;
+static guint  report_benchmark         = 0;
 
 static GOptionEntry options[] = {
   { "target", 0, 0, G_OPTION_ARG_STRING, &target,
-    "The Razor server to run performance tests against", "HOST" },
+    "The Razor servers to run performance tests against", "HOST[,HOST...]" },
+  { "target-policy", 0, 0, G_OPTION_ARG_STRING, &target_policy,
+    "Share requests between targets: sticky, round-robin, least-outstanding",
+    "POLICY" },
+  { "source", 0, 0, G_OPTION_ARG_STRING, &source,
+    "Spread nodes over these local addresses, or ranges of them",
+    "ADDR[-ADDR][,...]" },
   { "esxi-uuid", 0, 0, G_OPTION_ARG_STRING, &esxi_uuid,
     "The Razor ESXi OS image UUID", "UUID" },
   { "ubuntu-uuid", 0, 0, G_OPTION_ARG_STRING, &ubuntu_uuid,
@@ -30,20 +60,201 @@ static GOptionEntry options[] = {
     "How many simulated refresh events to perform", "COUNT" },
   { "population", 'p', 0, G_OPTION_ARG_INT, &population,
     "How many physical nodes in the population", "NODES" },
+  { "manifest", 0, 0, G_OPTION_ARG_FILENAME, &manifest,
+    "The scenario manifest to load", "FILE" },
+  { "define", 'D', 0, G_OPTION_ARG_STRING_ARRAY, &defines,
+    "Set a ${variable} used in scenario files", "NAME=VALUE" },
+  { "warmup", 0, 0, G_OPTION_ARG_INT, &warmup_seconds,
+    "Exclude requests started in the first SECONDS from summaries", "SECONDS" },
+  { "warmup-requests", 0, 0, G_OPTION_ARG_INT, &warmup_requests,
+    "Exclude the first COUNT requests from summaries", "COUNT" },
+  { "steady-state", 0, 0, G_OPTION_ARG_NONE, &steady_state,
+    "Only summarise requests in the detected steady state", NULL },
+  { "steady-window", 0, 0, G_OPTION_ARG_INT, &steady_window,
+    "Rolling window used for steady state detection", "SECONDS" },
+  { "steady-tolerance", 0, 0, G_OPTION_ARG_DOUBLE, &steady_tolerance,
+    "Coefficient of variation accepted as steady", "RATIO" },
+  { "replay", 0, 0, G_OPTION_ARG_FILENAME, &replay,
+    "Replay an access log instead of running the manifest", "FILE" },
+  { "replay-speed", 0, 0, G_OPTION_ARG_DOUBLE, &replay_speed,
+    "Replay speed multiplier, or 0 for as fast as possible", "N" },
+  { "replay-concurrency", 0, 0, G_OPTION_ARG_INT, &replay_concurrency,
+    "Nodes replayed at once when running as fast as possible", "COUNT" },
+  { "connect-timeout", 0, 0, G_OPTION_ARG_INT, &connect_timeout,
+    "Default connect timeout, unless the manifest sets one", "MS" },
+  { "timeout", 0, 0, G_OPTION_ARG_INT, &timeout,
+    "Default request timeout, unless the manifest sets one", "MS" },
+  { "control", 0, 0, G_OPTION_ARG_FILENAME, &control,
+    "Accept commands to change the run on a Unix socket", "PATH" },
+  { "trace-rate", 0, 0, G_OPTION_ARG_DOUBLE, &trace_rate,
+    "Fraction of requests to each URL written to network.csv and JTL; all "
+    "are still kept in memory for the summaries", "RATIO" },
+  { "trace-limit", 0, 0, G_OPTION_ARG_INT, &trace_limit,
+    "Most requests to each URL written, besides those always kept", "COUNT" },
+  { "trace-slow", 0, 0, G_OPTION_ARG_DOUBLE, &trace_slow,
+    "Always write requests slower than this percentile for the URL", "PERCENT" },
+  { "report-benchmark", 0, 0, G_OPTION_ARG_INT, &report_benchmark,
+    "Time writing the reports for COUNT made up requests, then exit", "COUNT" },
   { NULL }
 };
 
 
-static Event* event_new_with_url(ScenarioPart* parent, const char* url) {
-  Event* event          = g_new0(Event, 1);
-  event->scenario_part  = parent;
-  event->url            = g_strdup(url);
-  event->expect_success = TRUE;
-  return event;
+const char* service_names[SERVICE_COUNT] = {
+  [SERVICE_API]     = "api",
+  [SERVICE_FILES]   = "files",
+  [SERVICE_TFTP]    = "tftp",
+  [SERVICE_UNKNOWN] = "unknown"
+};
+
+Service service_for_url(const char* url) {
+  if (g_ascii_strncasecmp(url, "tftp:", 5) == 0)
+    return SERVICE_TFTP;
+
+  /* the port is the first thing after a colon in the authority */
+  const char* host = strstr(url, "://");
+  if (!host)
+    return SERVICE_UNKNOWN;
+  host += 3;
+
+  const char* path = strchr(host, '/');
+  const char* port = strchr(host, ':');
+  if (!port || (path && port > path))
+    return SERVICE_UNKNOWN;
+
+  switch (g_ascii_strtoull(port + 1, NULL, 10)) {
+  case 8026:
+    return SERVICE_API;
+  case 8027:
+    return SERVICE_FILES;
+  default:
+    return SERVICE_UNKNOWN;
+  }
+}
+
+/* strings in compiled events, interned once for the whole run */
+static GStringChunk* strings = NULL;
+
+static const char* intern(const char* text) {
+  if (!strings)
+    strings = g_string_chunk_new(4096);
+  return text ? g_string_chunk_insert_const(strings, text) : NULL;
+}
+
+static const char* intern_len(const char* text, gssize len) {
+  gchar*      copy   = g_strndup(text, len);
+  const char* result = intern(copy);
+  g_free(copy);
+  return result;
+}
+
+/* ' " < > & are the characters that can't appear in an XML attribute */
+static gchar* escape_label(const char* url) {
+  GString* label = g_string_sized_new(strlen(url));
+  for (const char* c = url; *c; ++c) {
+    switch (*c) {
+    case '\'':
+      g_string_append(label, "&apos;");
+      break;
+    case '"':
+      g_string_append(label, "&quot;");
+      break;
+    case '>':
+      g_string_append(label, "&gt;");
+      break;
+    case '<':
+      g_string_append(label, "&lt;");
+      break;
+    case '&':
+      g_string_append(label, "&amp;");
+      break;
+    default:
+      g_string_append_c(label, *c);
+    }
+  }
+  return g_string_free(label, FALSE);
+}
+
+/** what the reports show for a URL */
+typedef struct UrlInfo {
+  Service     service;
+  const char* scheme;
+  const char* path;
+  const char* label;
+} UrlInfo;
+
+/* interned URL => UrlInfo */
+static GHashTable* described = NULL;
+
+/* Target*, as the suite has them, which every event has a URL for */
+static GPtrArray* targets = NULL;
+
+static const UrlInfo* describe_url(const char* url) {
+  if (!described)
+    described = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+  UrlInfo* info = g_hash_table_lookup(described, url);
+  if (info)
+    return info;
+
+  UriUriA         uri;
+  UriParserStateA state = { .uri = &uri };
+  GString*        path  = g_string_new("");
+
+  info = g_new0(UrlInfo, 1);
+  if (uriParseUriA(&state, url) == URI_SUCCESS) {
+    info->scheme = uri.scheme.first
+      ? intern_len(uri.scheme.first, uri.scheme.afterLast - uri.scheme.first)
+      : intern("");
+    for (UriPathSegmentA* e = uri.pathHead; e; e = e->next) {
+      g_string_append_c(path, '/');
+      g_string_append_len(path, e->text.first, e->text.afterLast - e->text.first);
+    }
+  } else {
+    g_print("failed to parse URL %s\n", url);
+    info->scheme = intern("");
+  }
+  uriFreeUriMembersA(&uri);
+
+  gchar* label  = escape_label(url);
+  info->service = service_for_url(url);
+  info->path    = intern(path->str);
+  info->label   = intern(label);
+  g_free(label);
+  g_string_free(path, TRUE);
+
+  g_hash_table_insert(described, (gpointer)url, info);
+  return info;
 }
 
+void event_set_url(Event* event, guint target, const char* url) {
+  g_assert(target < targets->len);
 
+  if (!event->urls) {
+    event->urls   = g_new0(const char*, targets->len);
+    event->labels = g_new0(const char*, targets->len);
+  }
 
+  const char*    interned = intern(url);
+  const UrlInfo* info     = describe_url(interned);
+  event->urls[target]   = interned;
+  event->labels[target] = info->label;
+
+  /* the targets differ only by host, so the first speaks for all of them */
+  if (target == 0) {
+    event->url     = interned;
+    event->service = info->service;
+    event->scheme  = info->scheme;
+    event->path    = info->path;
+    event->label   = info->label;
+  }
+}
+
+static Event* event_new_with_url(const char* url) {
+  Event* event          = g_new0(Event, 1);
+  event->expect_success = TRUE;
+  event_set_url(event, 0, url);
+  return event;
+}
 
 static Scenario* scenario_new(const char* name) {
   Scenario* scenario = g_new0(Scenario, 1);
@@ -51,63 +262,473 @@ static Scenario* scenario_new(const char* name) {
   return scenario;
 }
 
+/* the target that ${target} is replaced with, for each in turn */
+static gchar* current = NULL;
+
 static struct {
   gchar*  name;
   gchar** value;
 } replace_find_var_table[] = {
-  { "target",      &target      },
+  { "target",      &current     },
   { "esxi_uuid",   &esxi_uuid   },
   { "ubuntu_uuid", &ubuntu_uuid },
   { "mk_uuid",     &mk_uuid     },
   { NULL }
 };
 
+/* additional variables, from the manifest and the command line */
+static GHashTable* variables = NULL;
+
+/* the shared scenario files refer to these, so any manifest can use them */
+static const struct {
+  const gchar* name;
+  const gchar* value;
+} variable_defaults[] = {
+  { "mk_boot_think",    "0" },
+  { "mk_checkin_think", "0" },
+  { NULL }
+};
+
 static gboolean replace_find_var(
   const GMatchInfo* info, GString* result, gpointer data_
 ) {
-  gchar* match = g_match_info_fetch(info, 1);
+  gchar*       match = g_match_info_fetch(info, 1);
+  const gchar* value = NULL;
+  gboolean     known = FALSE;
 
   for (int i = 0; replace_find_var_table[i].name; ++i) {
     if (g_strcmp0(match, replace_find_var_table[i].name) == 0) {
-      gchar* value = *(replace_find_var_table[i].value);
+      value = *(replace_find_var_table[i].value);
+      known = TRUE;
+      break;
+    }
+  }
 
-      if (result) {
-        g_string_append(result, value);
-        g_free(match);
-        return FALSE;           /* continue replacing */
-      }
+  /* command line options win, then anything the manifest defined */
+  if (!value && variables && g_hash_table_lookup(variables, match)) {
+    value = g_hash_table_lookup(variables, match);
+    known = TRUE;
+  }
 
-      g_critical("no value for replacement %s found", match);
-      exit(1);
-    }
+  if (value) {
+    g_string_append(result, value);
+    g_free(match);
+    return FALSE;               /* continue replacing */
   }
 
-  g_critical("unknown replacement %s found", match);
+  if (known)
+    g_critical("no value for replacement %s found", match);
+  else
+    g_critical("unknown replacement %s found", match);
   exit(1);
 }
 
 
+/* "250ms", "2s", "1m", or a bare number of milliseconds */
+static gboolean parse_duration(const char* text, guint64* value) {
+  gchar*  end    = NULL;
+  gdouble number = g_ascii_strtod(text, &end);
+
+  if (end == text || number < 0)
+    return FALSE;
+
+  if (*end == '\0' || g_strcmp0(end, "ms") == 0)
+    *value = number * 1000;
+  else if (g_strcmp0(end, "s") == 0)
+    *value = number * 1000000;
+  else if (g_strcmp0(end, "m") == 0)
+    *value = number * 60000000;
+  else
+    return FALSE;
+
+  return TRUE;
+}
+
+/* "2s" fixed, "1s..5s" uniform, or "exp:2s" or "exp:2s:30s" exponential with
+ * a mean, and optionally a limit */
+static gboolean parse_think(const char* text, Think* think) {
+  gboolean ok = FALSE;
+
+  if (g_str_has_prefix(text, "exp:")) {
+    gchar** pieces = g_strsplit(text + 4, ":", 2);
+    think->kind = THINK_EXPONENTIAL;
+    think->max  = G_MAXUINT64;
+    ok = parse_duration(pieces[0], &think->min) &&
+      (!pieces[1] || parse_duration(pieces[1], &think->max));
+    g_strfreev(pieces);
+  } else if (strstr(text, "..")) {
+    gchar** pieces = g_strsplit(text, "..", 2);
+    think->kind = THINK_UNIFORM;
+    ok = parse_duration(pieces[0], &think->min) &&
+      parse_duration(pieces[1], &think->max) && think->min <= think->max;
+    g_strfreev(pieces);
+  } else {
+    think->kind = THINK_FIXED;
+    ok = parse_duration(text, &think->min);
+    think->max = think->min;
+  }
+
+  return ok;
+}
+
+static void scenario_file_error(
+  const char* filename, int line, const char* format, const char* text
+) {
+  gchar* message = g_strdup_printf(format, text);
+  g_critical("%s:%d: %s", filename, line, message);
+  exit(1);
+}
+
+/* apply a "name=value" option from a scenario line to the event */
+static void scenario_event_option(
+  Event* event, const char* option, const char* filename, int line
+) {
+  const char* equals = strchr(option, '=');
+  if (!equals)
+    scenario_file_error(filename, line, "option '%s' should be name=value", option);
+
+  gchar*      name  = g_strndup(option, equals - option);
+  const char* value = equals + 1;
+
+  if (g_strcmp0(name, "method") == 0) {
+    gchar* method = g_ascii_strup(value, -1);
+    event->method = g_strcmp0(method, "GET") == 0 ? NULL : intern(method);
+    g_free(method);
+  } else if (g_strcmp0(name, "header") == 0) {
+    event->headers = curl_slist_append(event->headers, value);
+  } else if (g_strcmp0(name, "body") == 0) {
+    event->body = intern(value);
+  } else if (g_strcmp0(name, "group") == 0) {
+    event->group = intern(value);
+  } else if (g_strcmp0(name, "think") == 0) {
+    if (!parse_think(value, &event->think))
+      scenario_file_error(filename, line, "think time '%s' is not understood", value);
+  } else if (g_strcmp0(name, "pace") == 0) {
+    if (!parse_duration(value, &event->delay))
+      scenario_file_error(filename, line, "pace '%s' is not a duration", value);
+  } else if (g_strcmp0(name, "expect") == 0) {
+    if (g_strcmp0(value, "fail") == 0)
+      event->expect_success = FALSE;
+    else if (g_strcmp0(value, "success") == 0)
+      event->expect_success = TRUE;
+    else
+      scenario_file_error(filename, line, "expect '%s' should be success or fail", value);
+  } else {
+    scenario_file_error(filename, line, "unknown option '%s'", name);
+  }
+
+  g_free(name);
+}
+
+/* Compile a scenario file into events, once for the whole run; every part
+ * naming the same file shares the result.  Each line is a URL, then any of
+ *   method=POST header='Name: value' body='...' expect=fail
+ *   think=2s|1s..5s|exp:2s[:30s] pace=500ms group=NAME
+ * quoted as in the shell.  Blank lines and "#" comments are skipped.
+ */
+static GPtrArray* scenario_compile_file(const char* filename) {
+  static GHashTable* compiled = NULL;
+  if (!compiled)
+    compiled = g_hash_table_new(g_str_hash, g_str_equal);
+
+  GPtrArray* events = g_hash_table_lookup(compiled, filename);
+  if (events)
+    return events;
+
+  gchar*  content = NULL;
+  GError* error   = NULL;
+
+  if (!g_file_get_contents(filename, &content, NULL, &error) || error) {
+    g_critical("failed to read %s: %s", filename, error->message);
+    exit(1);
+  }
+
+  gchar** lines = g_strsplit(content, "\n", -1);
+  g_free(content);
+
+  GRegex* pattern = g_regex_new("\\${([^}]+)}", 0, 0, &error);
+  if (error || !pattern) {
+    g_critical("failed to compile regex: %s", error->message);
+    exit(1);
+  }
+
+  events = g_ptr_array_new();
+  for (int i = 0; lines[i]; ++i) {
+    gchar* text = g_strstrip(lines[i]);
+    if (text[0] == '\0' || text[0] == '#')
+      continue;
+
+    /* the line once for each target, for the URL; the options are the same
+     * for all of them, so they come from the first */
+    Event* event = NULL;
+    for (guint t = 0; t < targets->len; ++t) {
+      current = (gchar*)((Target*)g_ptr_array_index(targets, t))->name;
+
+      gchar* replaced = g_regex_replace_eval(
+        pattern,                  /* pattern to match */
+        text, -1,                 /* content to match on, and strlen */
+        0,                        /* start position */
+        0,                        /* match options */
+        replace_find_var, NULL,   /* eval callback, user arg to callback */
+        &error
+      );
+      if (error) {
+        g_critical("regex replace failure in %s - '%s':\n%s",
+                   filename, text, error->message);
+        exit(1);
+      }
+
+      gint    argc = 0;
+      gchar** argv = NULL;
+      if (!g_shell_parse_argv(replaced, &argc, &argv, &error))
+        scenario_file_error(filename, i + 1, "%s", error->message);
+
+      if (event) {
+        event_set_url(event, t, argv[0]);
+      } else {
+        event = event_new_with_url(argv[0]);
+        for (int j = 1; j < argc; ++j)
+          scenario_event_option(event, argv[j], filename, i + 1);
+      }
+
+      g_strfreev(argv);
+      g_free(replaced);
+    }
+
+    /* a body with no method is a POST, as curl would make it */
+    if (event->body && !event->method)
+      event->method = intern("POST");
+
+    g_ptr_array_add(events, event);
+  }
+
+  g_strfreev(lines);
+  g_regex_unref(pattern);
+
+  if (events->len == 0) {
+    g_critical("%s: no requests", filename);
+    exit(1);
+  }
+
+  g_hash_table_insert(compiled, g_strdup(filename), events);
+  return events;
+}
+
 static void scenario_add_part_from_file(
   Scenario*   scenario,
   const char* name,
-  const char* target,
   const char* filename
 ) {
   ScenarioPart* part = g_new0(ScenarioPart, 1);
   part->scenario = scenario;
   part->name     = g_strdup(name);
-  part->events   = g_ptr_array_new();
+  part->events   = scenario_compile_file(filename);
 
-  gchar*  content = NULL;
-  GError* error   = NULL;
+  scenario->parts = g_list_append(scenario->parts, part);
+}
 
-  if (!g_file_get_contents(filename, &content, NULL, &error) || error) {
-    g_critical("failed to read %s: %s", filename, error->message);
+static Scenario* find_scenario(TestSuite* suite, const char* name) {
+  for (guint i = 0; i < suite->scenarios->len; ++i) {
+    Scenario* scenario = g_ptr_array_index(suite->scenarios, i);
+    if (g_strcmp0(scenario->name, name) == 0)
+      return scenario;
+  }
+  return NULL;
+}
+
+static void manifest_check(const char* filename, GError* error) {
+  if (error) {
+    g_critical("%s: %s", filename, error->message);
+    exit(1);
+  }
+}
+
+/* "[scenario NAME]" groups define a scenario from an ordered list of parts,
+ * each of which is "part name:file name" - relative to the manifest. */
+static void manifest_load_scenario(
+  TestSuite*  suite,
+  GKeyFile*   keys,
+  const char* filename,
+  const char* dirname,
+  const char* group
+) {
+  GError*   error    = NULL;
+  Scenario* scenario = scenario_new(group + strlen("scenario "));
+
+  if (find_scenario(suite, scenario->name)) {
+    g_critical("%s: scenario %s is defined twice", filename, scenario->name);
     exit(1);
   }
 
-  gchar** urls = g_strsplit(content, "\n", -1);
-  g_free(content);
+  gchar** parts = g_key_file_get_string_list(keys, group, "parts", NULL, &error);
+  manifest_check(filename, error);
+
+  for (int i = 0; parts[i]; ++i) {
+    gchar** pair = g_strsplit(parts[i], ":", 2);
+    if (!pair[0] || !pair[1]) {
+      g_critical("%s: [%s] part '%s' should be 'name:file'",
+                 filename, group, parts[i]);
+      exit(1);
+    }
+
+    gchar* path = g_build_filename(dirname, g_strstrip(pair[1]), NULL);
+    scenario_add_part_from_file(scenario, g_strstrip(pair[0]), path);
+    g_free(path);
+    g_strfreev(pair);
+  }
+
+  g_strfreev(parts);
+  g_ptr_array_add(suite->scenarios, scenario);
+}
+
+/* "[class NAME]" groups define a node class, with a population relative to
+ * the number of physical nodes, an arrival rate, and a weighted list of
+ * "scenario:weight" to run when a node of that class is refreshed. */
+static void manifest_load_class(
+  TestSuite*  suite,
+  GKeyFile*   keys,
+  const char* filename,
+  const char* group
+) {
+  GError*    error = NULL;
+  NodeClass* klass = g_new0(NodeClass, 1);
+  klass->name      = g_strdup(group + strlen("class "));
+
+  double multiplier = 1.0;
+  if (g_key_file_has_key(keys, group, "population-multiplier", NULL)) {
+    multiplier = g_key_file_get_double(keys, group, "population-multiplier", &error);
+    manifest_check(filename, error);
+  }
+  klass->nodes = ceil((double)suite->population * multiplier);
+
+  if (g_key_file_has_key(keys, group, "refreshes-per-second", NULL)) {
+    klass->refreshes_per_second =
+      g_key_file_get_double(keys, group, "refreshes-per-second", &error);
+    manifest_check(filename, error);
+    klass->refresh_percent =
+      klass->nodes ? klass->refreshes_per_second * 86400 * 100 / klass->nodes : 0;
+  } else {
+    klass->refresh_percent =
+      g_key_file_get_double(keys, group, "refresh-percent", &error);
+    manifest_check(filename, error);
+
+    const double refreshes_per_day =
+      (double)klass->nodes * klass->refresh_percent / 100;
+    klass->refreshes_per_second = refreshes_per_day / (double)86400;
+  }
+
+  /* as ever, we need *some* forward motion... */
+  klass->refreshes_per_second = MAX(klass->refreshes_per_second, 0.01);
+
+  gchar** mix = g_key_file_get_string_list(keys, group, "scenarios", NULL, &error);
+  manifest_check(filename, error);
+
+  gchar* problem = node_class_set_mix(klass, suite, mix);
+  if (problem) {
+    g_critical("%s: [%s] %s", filename, group, problem);
+    exit(1);
+  }
+  g_strfreev(mix);
+
+  g_ptr_array_add(suite->classes, klass);
+}
+
+static guint manifest_get_uint(
+  GKeyFile* keys, const char* filename, const char* group,
+  const char* key, guint fallback
+) {
+  GError* error = NULL;
+  if (!g_key_file_has_key(keys, group, key, NULL))
+    return fallback;
+
+  gint value = g_key_file_get_integer(keys, group, key, &error);
+  manifest_check(filename, error);
+  return MAX(value, 0);
+}
+
+/* "[service NAME]" groups set the timeouts and retries used against one of
+ * the Razor services; anything not set keeps the command line default. */
+static void manifest_load_service(
+  TestSuite*  suite,
+  GKeyFile*   keys,
+  const char* filename,
+  const char* group
+) {
+  const char* name = group + strlen("service ");
+  Service     service;
+
+  for (service = 0; service < SERVICE_COUNT; ++service)
+    if (g_strcmp0(name, service_names[service]) == 0)
+      break;
+
+  if (service == SERVICE_COUNT) {
+    g_critical("%s: [%s] is not a known service", filename, group);
+    exit(1);
+  }
+
+  RetryPolicy* policy = &suite->policies[service];
+  policy->connect_timeout =
+    manifest_get_uint(keys, filename, group, "connect-timeout", policy->connect_timeout);
+  policy->timeout   = manifest_get_uint(keys, filename, group, "timeout", policy->timeout);
+  policy->attempts  = MAX(manifest_get_uint(keys, filename, group, "attempts", 1), 1);
+  policy->delay     = manifest_get_uint(keys, filename, group, "delay", 1000);
+  policy->max_delay = manifest_get_uint(keys, filename, group, "max-delay", 60000);
+  policy->reboots   = manifest_get_uint(keys, filename, group, "reboots", 0);
+
+  gchar* backoff = g_key_file_get_string(keys, group, "backoff", NULL);
+  if (!backoff || g_strcmp0(backoff, "fixed") == 0)
+    policy->backoff = RETRY_FIXED;
+  else if (g_strcmp0(backoff, "exponential") == 0)
+    policy->backoff = RETRY_EXPONENTIAL;
+  else if (g_strcmp0(backoff, "jitter") == 0)
+    policy->backoff = RETRY_JITTER;
+  else {
+    g_critical("%s: [%s] unknown backoff '%s'", filename, group, backoff);
+    exit(1);
+  }
+  g_free(backoff);
+}
+
+/* the heartbeat URL keeps ${hw_id} for each checkin to fill in */
+static gboolean heartbeat_find_var(
+  const GMatchInfo* info, GString* result, gpointer data
+) {
+  gchar* match = g_match_info_fetch(info, 1);
+  if (g_strcmp0(match, "hw_id") == 0) {
+    g_string_append(result, "${hw_id}");
+    g_free(match);
+    return FALSE;               /* continue replacing */
+  }
+
+  g_free(match);
+  return replace_find_var(info, result, data);
+}
+
+/* "[heartbeat]" sets up the idle population checking in from the microkernel,
+ * in proportion to the physical nodes like a class, on the Razor timer. */
+static void manifest_load_heartbeat(
+  TestSuite*  suite,
+  GKeyFile*   keys,
+  const char* filename,
+  const char* group
+) {
+  GError*    error     = NULL;
+  Heartbeat* heartbeat = &suite->heartbeat;
+
+  double multiplier = 1.0;
+  if (g_key_file_has_key(keys, group, "population-multiplier", NULL)) {
+    multiplier = g_key_file_get_double(keys, group, "population-multiplier", &error);
+    manifest_check(filename, error);
+  }
+  heartbeat->nodes       = ceil((double)suite->population * multiplier);
+  heartbeat->interval    = MAX(manifest_get_uint(keys, filename, group, "interval", 60000), 1);
+  heartbeat->jitter      = MIN(manifest_get_uint(keys, filename, group, "jitter", 0),
+                               heartbeat->interval);
+  heartbeat->concurrency = MAX(manifest_get_uint(keys, filename, group, "concurrency", 256), 1);
+
+  gchar* url = g_key_file_get_string(keys, group, "url", NULL);
+  if (!url)
+    url = g_strdup("http://${target}:8026/razor/api/node/checkin?hw_id=${hw_id}&last_state=idle");
 
   GRegex* pattern = g_regex_new("\\${([^}]+)}", 0, 0, &error);
   if (error || !pattern) {
@@ -115,28 +736,238 @@ static void scenario_add_part_from_file(
     exit(1);
   }
 
-  for (int i = 0; urls[i]; ++i) {
-    gchar* url = g_regex_replace_eval(
-      pattern,                  /* pattern to match */
-      urls[i], -1,              /* content to match on, and strlen */
-      0,                        /* start position */
-      0,                        /* match options */
-      replace_find_var, NULL,   /* eval callback, user arg to callback */
-      &error
+  /* every node reports against the one URL for each target, so the reports
+   * stay the size of the URL list rather than of the population */
+  Scenario*     idle = scenario_new("idle");
+  ScenarioPart* part = g_new0(ScenarioPart, 1);
+  part->scenario     = idle;
+  part->name         = "heartbeat";
+  part->events       = g_ptr_array_new();
+  idle->parts        = g_list_append(NULL, part);
+  heartbeat->part    = part;
+
+  heartbeat->url_prefixes = g_new0(gchar*, targets->len + 1);
+  heartbeat->url_suffixes = g_new0(gchar*, targets->len + 1);
+  for (guint t = 0; t < targets->len; ++t) {
+    current = (gchar*)((Target*)g_ptr_array_index(targets, t))->name;
+
+    gchar* replaced = g_regex_replace_eval(
+      pattern, url, -1, 0, 0, heartbeat_find_var, NULL, &error
     );
     if (error) {
-      g_critical("regex replace failure in %s - '%s':\n%s",
-                 filename, url, error->message);
+      g_critical("%s: [%s] url '%s': %s", filename, group, url, error->message);
       exit(1);
     }
 
-    g_ptr_array_add(part->events, event_new_with_url(part, url));
+    gchar** pieces = g_strsplit(replaced, "${hw_id}", 2);
+    if (!pieces[0] || !pieces[1]) {
+      g_critical("%s: [%s] url '%s' has no ${hw_id}", filename, group, url);
+      exit(1);
+    }
+    heartbeat->url_prefixes[t] = pieces[0];
+    heartbeat->url_suffixes[t] = pieces[1];
+
+    if (t == 0)
+      heartbeat->event = event_new_with_url(replaced);
+    else
+      event_set_url(heartbeat->event, t, replaced);
+
+    g_free(pieces);             /* the strings are kept in the heartbeat */
+    g_free(replaced);
   }
+  g_ptr_array_add(part->events, heartbeat->event);
 
-  g_strfreev(urls);
+  g_free(url);
   g_regex_unref(pattern);
+}
 
-  scenario->parts = g_list_append(scenario->parts, part);
+static void manifest_load(TestSuite* suite, const char* filename) {
+  GError*   error = NULL;
+  GKeyFile* keys  = g_key_file_new();
+
+  if (!g_key_file_load_from_file(keys, filename, G_KEY_FILE_NONE, &error)) {
+    g_critical("failed to read manifest %s: %s", filename, error->message);
+    exit(1);
+  }
+
+  gchar*  dirname = g_path_get_dirname(filename);
+  gchar** groups  = g_key_file_get_groups(keys, NULL);
+
+  /* "[variables]" are available to scenario files, but --define wins */
+  variables = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  for (int i = 0; variable_defaults[i].name; ++i)
+    g_hash_table_insert(
+      variables, g_strdup(variable_defaults[i].name),
+      g_strdup(variable_defaults[i].value)
+    );
+  if (g_key_file_has_group(keys, "variables")) {
+    gchar** names = g_key_file_get_keys(keys, "variables", NULL, NULL);
+    for (int i = 0; names[i]; ++i)
+      g_hash_table_insert(
+        variables, g_strdup(names[i]),
+        g_key_file_get_string(keys, "variables", names[i], NULL)
+      );
+    g_strfreev(names);
+  }
+
+  for (int i = 0; defines && defines[i]; ++i) {
+    gchar** pair = g_strsplit(defines[i], "=", 2);
+    if (!pair[0] || !pair[1]) {
+      g_critical("--define %s should be NAME=VALUE", defines[i]);
+      exit(1);
+    }
+    g_hash_table_insert(variables, g_strdup(pair[0]), g_strdup(pair[1]));
+    g_strfreev(pair);
+  }
+
+  /* scenarios first, so that classes can refer to them in any order */
+  for (int i = 0; groups[i]; ++i)
+    if (g_str_has_prefix(groups[i], "scenario "))
+      manifest_load_scenario(suite, keys, filename, dirname, groups[i]);
+
+  for (int i = 0; groups[i]; ++i) {
+    if (g_str_has_prefix(groups[i], "class "))
+      manifest_load_class(suite, keys, filename, groups[i]);
+    else if (g_str_has_prefix(groups[i], "service "))
+      manifest_load_service(suite, keys, filename, groups[i]);
+    else if (g_strcmp0(groups[i], "heartbeat") == 0)
+      manifest_load_heartbeat(suite, keys, filename, groups[i]);
+    else if (!g_str_has_prefix(groups[i], "scenario ") &&
+             g_strcmp0(groups[i], "variables") != 0) {
+      g_critical("%s: unknown manifest section [%s]", filename, groups[i]);
+      exit(1);
+    }
+  }
+
+  if (suite->classes->len == 0) {
+    g_critical("%s: no node classes defined", filename);
+    exit(1);
+  }
+
+  g_strfreev(groups);
+  g_free(dirname);
+  g_key_file_free(keys);
+}
+
+gchar* node_class_set_mix(NodeClass* klass, TestSuite* suite, gchar** mix) {
+  GPtrArray* scenarios = g_ptr_array_new();
+  GArray*    weights   = g_array_new(FALSE, TRUE, sizeof(guint));
+  guint      total     = 0;
+  gchar*     problem   = NULL;
+
+  for (int i = 0; mix[i] && !problem; ++i) {
+    gchar**   pair     = g_strsplit(mix[i], ":", 2);
+    Scenario* scenario = find_scenario(suite, g_strstrip(pair[0]));
+    guint64   weight   = 1;
+
+    if (!scenario)
+      problem = g_strdup_printf("uses undefined scenario '%s'", pair[0]);
+    else if (pair[1]) {
+      gchar* end = NULL;
+      weight = g_ascii_strtoull(g_strstrip(pair[1]), &end, 10);
+      if (end == pair[1] || *end != '\0' || weight > G_MAXUINT)
+        problem = g_strdup_printf(
+          "gives scenario '%s' a weight of '%s', not a whole number", pair[0], pair[1]
+        );
+    }
+
+    g_strfreev(pair);
+
+    /* a zero weight is allowed, and just disables the scenario */
+    if (problem || weight == 0)
+      continue;
+
+    total += weight;
+    g_ptr_array_add(scenarios, scenario);
+    g_array_append_val(weights, total);
+  }
+
+  if (!problem && total == 0)
+    problem = g_strdup("has no scenarios with a weight");
+
+  if (problem) {
+    g_ptr_array_free(scenarios, TRUE);
+    g_array_free(weights, TRUE);
+    return problem;
+  }
+
+  if (klass->scenarios) {
+    g_ptr_array_free(klass->scenarios, TRUE);
+    g_array_free(klass->weights, TRUE);
+  }
+  klass->scenarios    = scenarios;
+  klass->weights      = weights;
+  klass->total_weight = total;
+  return NULL;
+}
+
+Scenario* node_class_pick_scenario(const NodeClass* klass, TestSuite* suite) {
+  guint pick = g_rand_int_range(suite->rand, 0, klass->total_weight);
+
+  /* the weights are cumulative, so the first one above our pick wins */
+  for (guint i = 0; i < klass->weights->len; ++i)
+    if (pick < g_array_index(klass->weights, guint, i))
+      return g_ptr_array_index(klass->scenarios, i);
+
+  g_assert_not_reached();
+}
+
+/* spread node numbers over all 32 bits, so that nodes numbered in turn
+ * stick to targets in no particular order */
+static guint node_hash(guint node) {
+  node ^= node >> 16;
+  node *= 0x7feb352d;
+  node ^= node >> 15;
+  node *= 0x846ca68b;
+  node ^= node >> 16;
+  return node;
+}
+
+gint target_for_node(TestSuite* suite, guint node) {
+  if (suite->target_policy != TARGET_STICKY)
+    return -1;
+
+  return node_hash(node) % suite->targets->len;
+}
+
+guint target_acquire(TestSuite* suite, guint node) {
+  const guint count  = suite->targets->len;
+  guint       target = 0;
+
+  switch (count > 1 ? suite->target_policy : TARGET_STICKY) {
+  case TARGET_STICKY:
+    target = node_hash(node) % count;
+    break;
+
+  case TARGET_ROUND_ROBIN:
+    target = (guint)g_atomic_int_add(&suite->next_target, 1) % count;
+    break;
+
+  case TARGET_LEAST_OUTSTANDING: {
+    /* the counts change under us, so this is only as exact as a load
+     * balancer would be; the scan starts in turn so that ties are shared
+     * out, rather than all going to the first target */
+    const guint first = (guint)g_atomic_int_add(&suite->next_target, 1) % count;
+    gint        least = G_MAXINT;
+    for (guint i = 0; i < count; ++i) {
+      const guint candidate   = (first + i) % count;
+      Target*     t           = g_ptr_array_index(suite->targets, candidate);
+      const gint  outstanding = g_atomic_int_get(&t->outstanding);
+      if (outstanding < least) {
+        least  = outstanding;
+        target = candidate;
+      }
+    }
+    break;
+  }
+  }
+
+  g_atomic_int_inc(&((Target*)g_ptr_array_index(suite->targets, target))->outstanding);
+  return target;
+}
+
+void target_release(TestSuite* suite, guint target) {
+  g_atomic_int_add(&((Target*)g_ptr_array_index(suite->targets, target))->outstanding, -1);
 }
 
 
@@ -151,8 +982,15 @@ static void scenario_add_part_from_file(
   } while (0)
 
 typedef struct EventClosure {
-  TestSuite* suite;
-  CURL*      curl;
+  TestSuite*          suite;
+  guint               node;     /* for sticky targets */
+  CURL*               curl;
+  const ScenarioPart* part;     /* the part being run, reported against */
+  guint64             previous; /* when the previous event started */
+  guint64             finished; /* when the previous event ended */
+  guint               reboot;   /* times this node restarted the scenario */
+  guint               reboots[SERVICE_COUNT];   /* the same, by service */
+  GPtrArray*          group;    /* CURL*, spare handles for groups */
 } EventClosure;
 
 static size_t scenario_track_curl_write(
@@ -168,27 +1006,317 @@ static size_t scenario_track_curl_write(
   return size * count;
 }
 
-static void scenario_run_event(const Event* event, EventClosure* closure) {
-  EventFinished *data = stats_event_finished_new(event);
+/* microseconds a node thinks for before an event */
+static guint64 think_time(const Think* think) {
+  switch (think->kind) {
+  case THINK_NONE:
+    return 0;
 
-  curlopt(closure->curl, CURLOPT_URL,       event->url);
-  curlopt(closure->curl, CURLOPT_WRITEDATA, data);
+  case THINK_FIXED:
+    return think->min;
 
-  data->start  = g_get_monotonic_time();
-  CURLcode c   = curl_easy_perform(closure->curl);
-  data->finish = g_get_monotonic_time();
+  case THINK_UNIFORM:
+    return g_random_double_range(think->min, think->max);
+
+  case THINK_EXPONENTIAL:
+    return MIN(-log(1.0 - g_random_double()) * think->min, think->max);
+  }
+
+  g_assert_not_reached();
+}
+
+/* sleep until the given time, waking early if the run is aborted */
+static void scenario_sleep_until(TestSuite* suite, guint64 due) {
+  for (guint64 now = g_get_monotonic_time(); due > now; now = g_get_monotonic_time()) {
+    if (g_atomic_int_get(&suite->aborting))
+      return;
+    g_usleep(MIN(due - now, SCENARIO_SLEEP_SLICE));
+  }
+}
+
+static void scenario_wait_for_event(const Event* event, EventClosure* closure) {
+  guint64 due = 0;
+
+  /* the delay is between arrivals, so a slow response eats into it */
+  if (event->delay && closure->previous)
+    due = closure->previous + event->delay;
+
+  /* ...while thinking starts once the previous response is in */
+  if (event->think.kind != THINK_NONE && closure->finished)
+    due = MAX(due, closure->finished + think_time(&event->think));
+
+  scenario_sleep_until(closure->suite, due);
+}
+
+/* milliseconds to wait before the given retry, counting from one */
+static guint64 retry_delay(const RetryPolicy* policy, guint retry) {
+  double delay = policy->delay;
+
+  switch (policy->backoff) {
+  case RETRY_FIXED:
+    break;
+
+  case RETRY_EXPONENTIAL:
+    delay = MIN(delay * pow(2, retry - 1), policy->max_delay);
+    break;
+
+  case RETRY_JITTER:
+    /* "full jitter": anywhere up to the exponential backoff */
+    delay = g_random_double_range(0, MIN(delay * pow(2, retry - 1), policy->max_delay));
+    break;
+  }
+
+  return delay;
+}
+
+/* point the handle at a URL, with the request options of the event, and
+ * the timeouts of its service policy; a handle runs many different events,
+ * so every option is set each time */
+static void scenario_prepare(CURL* curl, const Event* event, const char* url) {
+  curlopt(curl, CURLOPT_URL, url);
+  sources_prepare(curl, event);
+
+  curlopt(curl, CURLOPT_HTTPGET, 1L);
+  if (event->body) {
+    curlopt(curl, CURLOPT_POSTFIELDS, event->body);
+    curlopt(curl, CURLOPT_POSTFIELDSIZE, (long)strlen(event->body));
+  }
+  if (g_strcmp0(event->method, "HEAD") == 0) {
+    curlopt(curl, CURLOPT_NOBODY, 1L);
+    curlopt(curl, CURLOPT_CUSTOMREQUEST, NULL);
+  } else {
+    curlopt(curl, CURLOPT_CUSTOMREQUEST, event->method);
+  }
+  curlopt(curl, CURLOPT_HTTPHEADER, event->headers);
+}
+
+static void scenario_prepare_timeouts(CURL* curl, const RetryPolicy* policy) {
+  curlopt(curl, CURLOPT_CONNECTTIMEOUT_MS, (long)policy->connect_timeout);
+  curlopt(curl, CURLOPT_TIMEOUT_MS, (long)policy->timeout);
+}
+
+/* judge an attempt by the result curl gave, and what the event expected */
+static void scenario_judge(const Event* event, EventFinished* data, CURLcode c) {
+  data->connect_failed = c == CURLE_COULDNT_CONNECT;
 
   switch (c) {
   case CURLE_OK:
     data->successful = event->expect_success;
     break;
 
+  case CURLE_OPERATION_TIMEDOUT:
+    data->timed_out  = TRUE;
+    /* fall through */
   default:
     data->successful = !event->expect_success;
     break;
   }
+}
+
+/* make one attempt at the prepared request, timing it into data */
+static void scenario_perform(CURL* curl, const Event* event, EventFinished* data) {
+  curlopt(curl, CURLOPT_WRITEDATA, data);
+
+  data->source = sources_index(curl);
+  data->start  = g_get_monotonic_time();
+  CURLcode c   = curl_easy_perform(curl);
+  data->finish = g_get_monotonic_time();
+  sources_learn(curl);
+
+  scenario_judge(event, data, c);
+}
+
+/* make the attempts at an event from the given one on, as the service
+ * policy allows, reporting each.  Every attempt picks a target afresh, as a
+ * load balancer would.  Returns the success of the last. */
+static gboolean scenario_attempts(
+  const Event* event, EventClosure* closure, guint first
+) {
+  TestSuite*         suite  = closure->suite;
+  const RetryPolicy* policy = &suite->policies[event->service];
+
+  for (guint attempt = first; attempt <= policy->attempts; ++attempt) {
+    if (attempt > 1)
+      scenario_sleep_until(
+        suite, g_get_monotonic_time() + retry_delay(policy, attempt - 1) * 1000
+      );
+    if (g_atomic_int_get(&suite->aborting))
+      break;
+
+    EventFinished *data = stats_event_finished_new(event, closure->part);
+    data->attempt = attempt;
+    data->reboot  = closure->reboot;
+    data->target  = target_acquire(suite, closure->node);
+
+    scenario_prepare(closure->curl, event, event->urls[data->target]);
+    scenario_prepare_timeouts(closure->curl, policy);
+    scenario_perform(closure->curl, event, data);
+    target_release(suite, data->target);
+    if (attempt == 1)
+      closure->previous = data->start;
+    closure->finished = data->finish;
+
+    gboolean successful = data->successful;
+    stats_event_finished(closure->suite->stats, data);
+
+    if (successful)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* run an event, retrying as the service policy says; each attempt is
+ * reported separately.  Returns the success of the final attempt. */
+static gboolean scenario_run_event(const Event* event, EventClosure* closure) {
+  scenario_wait_for_event(event, closure);
+  return scenario_attempts(event, closure, 1);
+}
+
+/* run a group of events at once, as a node fetching modules in parallel
+ * would; the first attempts are made together, and any retries after that
+ * one at a time.  Returns the first event that ran out of attempts, or NULL
+ * if every one of them succeeded. */
+static const Event* scenario_run_group(
+  GPtrArray* events, guint first, guint last, EventClosure* closure
+) {
+  const guint     count   = last - first;
+  CURLM*          multi   = curl_multi_init();
+  EventFinished** results = g_new0(EventFinished*, count);
+
+  scenario_wait_for_event(g_ptr_array_index(events, first), closure);
+
+  while (closure->group->len < count) {
+    CURL* curl = scenario_curl_new(closure->suite, TRUE);
+    sources_attach(curl, closure->suite, closure->node);
+    g_ptr_array_add(closure->group, curl);
+  }
+
+  const guint64 start = g_get_monotonic_time();
+  for (guint i = 0; i < count; ++i) {
+    const Event* event = g_ptr_array_index(events, first + i);
+    CURL*        curl  = g_ptr_array_index(closure->group, i);
+
+    results[i] = stats_event_finished_new(event, closure->part);
+    results[i]->attempt = 1;
+    results[i]->reboot  = closure->reboot;
+    results[i]->target  = target_acquire(closure->suite, closure->node);
+    results[i]->source  = sources_index(curl);
+    results[i]->start   = start;
+
+    scenario_prepare(curl, event, event->urls[results[i]->target]);
+    scenario_prepare_timeouts(curl, &closure->suite->policies[event->service]);
+    curlopt(curl, CURLOPT_WRITEDATA, results[i]);
+    curl_multi_add_handle(multi, curl);
+  }
+
+  int running = count;
+  while (running > 0) {
+    CURLMcode c = curl_multi_perform(multi, &running);
+    if (c != CURLM_OK) {
+      g_critical("curl multi failure: %s", curl_multi_strerror(c));
+      exit(1);
+    }
+
+    CURLMsg* message;
+    int      left;
+    while ((message = curl_multi_info_read(multi, &left))) {
+      if (message->msg != CURLMSG_DONE)
+        continue;
+
+      for (guint i = 0; i < count; ++i) {
+        if (g_ptr_array_index(closure->group, i) != message->easy_handle)
+          continue;
+
+        results[i]->finish = g_get_monotonic_time();
+        sources_learn(message->easy_handle);
+        scenario_judge(results[i]->event, results[i], message->data.result);
+        target_release(closure->suite, results[i]->target);
+      }
+    }
+
+    if (running > 0)
+      curl_multi_wait(multi, NULL, 0, 1000, NULL);
+  }
+
+  closure->previous = start;
+  const Event* failed = NULL;
+  for (guint i = 0; i < count; ++i) {
+    EventFinished* data  = results[i];
+    const Event*   event = data->event;
+    gboolean       ok    = data->successful;
+
+    curl_multi_remove_handle(multi, g_ptr_array_index(closure->group, i));
+    closure->finished = MAX(closure->finished, data->finish);
+    stats_event_finished(closure->suite->stats, data);
+
+    if (!ok && !scenario_attempts(event, closure, 2) && !failed)
+      failed = event;
+  }
+
+  curl_multi_cleanup(multi);
+  g_free(results);
+  return failed;
+}
+
+gboolean scenario_run_once(
+  const ScenarioPart* part, const Event* event, guint target, const char* url,
+  CURL* curl, TestSuite* suite
+) {
+  scenario_prepare(curl, event, url);
+  scenario_prepare_timeouts(curl, &suite->policies[event->service]);
+
+  EventFinished* data = stats_event_finished_new(event, part);
+  data->attempt = 1;
+  data->target  = target;
+  scenario_perform(curl, event, data);
+
+  gboolean successful = data->successful;
+  stats_heartbeat_finished(suite->stats, data);
+  return successful;
+}
 
-  stats_event_finished(closure->suite->stats, data);
+gboolean scenario_run_request(
+  const ScenarioPart* part, const Event* event, guint node, CURL* curl,
+  TestSuite* suite
+) {
+  EventClosure closure = {
+    .suite = suite,
+    .node  = node,
+    .curl  = curl,
+    .part  = part
+  };
+
+  return scenario_attempts(event, &closure, 1);
+}
+
+/* curl calls this at least once a second, even on a stalled transfer, so
+ * that a run out of time need not wait on the server */
+static int scenario_curl_progress(
+  void* data, curl_off_t dltotal, curl_off_t dlnow,
+  curl_off_t ultotal, curl_off_t ulnow
+) {
+  TestSuite* suite = data;
+  return g_atomic_int_get(&suite->aborting);
+}
+
+CURL* scenario_curl_new(TestSuite* suite, gboolean reuse) {
+  CURL* curl = curl_easy_init();
+
+  curlopt(curl, CURLOPT_VERBOSE, 0);
+  curlopt(curl, CURLOPT_WRITEFUNCTION, scenario_track_curl_write);
+  curlopt(curl, CURLOPT_FOLLOWLOCATION, 1);
+  curlopt(curl, CURLOPT_MAXREDIRS, 7);
+  /* timeouts must not use signals, since we run many threads */
+  curlopt(curl, CURLOPT_NOSIGNAL, 1);
+  curlopt(curl, CURLOPT_XFERINFOFUNCTION, scenario_curl_progress);
+  curlopt(curl, CURLOPT_XFERINFODATA, suite);
+  curlopt(curl, CURLOPT_NOPROGRESS, 0L);
+
+  if (!reuse)
+    curlopt(curl, CURLOPT_FORBID_REUSE, 1);
+
+  return curl;
 }
 
 
@@ -202,61 +1330,99 @@ TestSuite* test_suite_setup(int* argc, char*** argv) {
   }
 
   TestSuite* suite = g_new0(TestSuite, 1);
+
+  /* "--target a,b,c" shares the load between replicas; with no target at
+   * all, there is still one, for URLs that name their host */
+  suite->targets = g_ptr_array_new();
+  gchar** names  = g_strsplit(target ? target : "", ",", -1);
+  for (int i = 0; names[i]; ++i) {
+    if (*g_strstrip(names[i]) == '\0')
+      continue;
+    Target* t = g_new0(Target, 1);
+    t->name   = g_strdup(names[i]);
+    g_ptr_array_add(suite->targets, t);
+  }
+  g_strfreev(names);
+  if (suite->targets->len == 0)
+    g_ptr_array_add(suite->targets, g_new0(Target, 1));
+  targets = suite->targets;
+
+  if (g_strcmp0(target_policy, "sticky") == 0)
+    suite->target_policy = TARGET_STICKY;
+  else if (g_strcmp0(target_policy, "round-robin") == 0)
+    suite->target_policy = TARGET_ROUND_ROBIN;
+  else if (g_strcmp0(target_policy, "least-outstanding") == 0)
+    suite->target_policy = TARGET_LEAST_OUTSTANDING;
+  else {
+    g_critical("--target-policy %s should be sticky, round-robin, or "
+               "least-outstanding", target_policy);
+    exit(1);
+  }
+
+  sources_load(suite, source);
+
+  /* the stats keep totals for each target and source, so they come after */
   suite->stats = stats_new(suite);
 
   /* calculate our run rates, etc */
-  suite->max_cycles               = max_cycles;
-  suite->target                   = target;
-  suite->load                     = load;
-  suite->physical_nodes           = population;
-  suite->virtual_nodes            = population * virtual_per_physical;
-  suite->nodes                    = suite->physical_nodes +
-                                    suite->virtual_nodes;
-  suite->physical_refresh_percent = physical_refresh_percent;
-  suite->virtual_refresh_percent  = virtual_refresh_percent;
-  suite->virtual_per_physical     = virtual_per_physical;
-
-  const double physical_refreshes_per_day =
-    ((double)suite->physical_nodes * suite->physical_refresh_percent);
-  const double virtual_refreshes_per_day =
-    ((double)suite->virtual_nodes  * suite->virtual_refresh_percent);
-
-  suite->physical_refreshes_per_second =
-    MAX(physical_refreshes_per_day / (double)86400, 0.01);
-
-  suite->virtual_refreshes_per_second =
-    MAX(virtual_refreshes_per_day / (double)86400, 0.01);
+  suite->max_cycles = max_cycles;
+  suite->load       = load;
+  suite->population = population;
+  suite->control    = control;
+  suite->rand       = g_rand_new();
+  suite->scenarios  = g_ptr_array_new();
+  suite->classes    = g_ptr_array_new();
+
+  suite->warmup_seconds   = warmup_seconds;
+  suite->warmup_requests  = warmup_requests;
+  suite->steady_state     = steady_state;
+  suite->steady_window    = MAX(steady_window, 2);
+  suite->steady_tolerance = steady_tolerance;
+
+  suite->trace_rate  = CLAMP(trace_rate, 0, 1);
+  suite->trace_limit = trace_limit;
+  suite->trace_slow  = CLAMP(trace_slow, 0, 100);
+
+  suite->report_benchmark = report_benchmark;
+
+  for (Service service = 0; service < SERVICE_COUNT; ++service) {
+    suite->policies[service].connect_timeout = connect_timeout;
+    suite->policies[service].timeout         = timeout;
+    suite->policies[service].attempts        = 1;
+  }
+
+  suite->replay             = g_ptr_array_new();
+  suite->replay_requests    = g_array_new(FALSE, FALSE, sizeof(ReplayRequest));
+  suite->replay_speed       = MAX(replay_speed, 0);
+  suite->replay_concurrency = MAX(replay_concurrency, 1);
+
+  /* a replay has its own timeline, so the manifest plays no part in it */
+  if (replay) {
+    replay_load(suite, replay);
+    return suite;
+  }
+
+  /* create the set of scenarios and node classes, and make them available */
+  manifest_load(suite, manifest);
+
+  for (guint i = 0; i < suite->classes->len; ++i) {
+    NodeClass* klass = g_ptr_array_index(suite->classes, i);
+    suite->nodes                += klass->nodes;
+    suite->refreshes_per_second += klass->refreshes_per_second;
+  }
 
   /* now, how many total events of each type to reach a load of $load? */
-  const double total_refreshes_per_second =
-    suite->physical_refreshes_per_second + suite->virtual_refreshes_per_second;
-
-  const double seconds_to_hit_load = (double)load / total_refreshes_per_second;
-
-  suite->physical_refresh_events =
-    ceil(seconds_to_hit_load * suite->physical_refreshes_per_second);
-  suite->virtual_refresh_events =
-    ceil(seconds_to_hit_load * suite->virtual_refreshes_per_second);
-
-  suite->approximate_runtime = MAX(
-    ceil(((double)suite->physical_refresh_events - 1)
-         / suite->physical_refreshes_per_second),
-    ceil(((double)suite->virtual_refresh_events - 1)
-         / suite->virtual_refreshes_per_second)
-  );
-
-  /* create the set of scenarios, and make them available */
-  suite->esxi = scenario_new("esxi");
-  scenario_add_part_from_file(suite->esxi, "initial PXE", target, "pxe.scenario");
-  scenario_add_part_from_file(suite->esxi, "microkernel", target, "mk.scenario");
-  scenario_add_part_from_file(suite->esxi, "PXE",         target, "pxe.scenario");
-  scenario_add_part_from_file(suite->esxi, "install",     target, "esxi.scenario");
-
-  suite->ubuntu = scenario_new("ubuntu");
-  scenario_add_part_from_file(suite->ubuntu, "initial PXE", target, "pxe.scenario");
-  scenario_add_part_from_file(suite->ubuntu, "microkernel", target, "mk.scenario");
-  scenario_add_part_from_file(suite->ubuntu, "PXE",         target, "pxe.scenario");
-  scenario_add_part_from_file(suite->ubuntu, "install",     target, "ubuntu.scenario");
+  const double seconds_to_hit_load = (double)load / suite->refreshes_per_second;
+
+  for (guint i = 0; i < suite->classes->len; ++i) {
+    NodeClass* klass = g_ptr_array_index(suite->classes, i);
+    klass->refresh_events = ceil(seconds_to_hit_load * klass->refreshes_per_second);
+
+    suite->approximate_runtime = MAX(
+      suite->approximate_runtime,
+      ceil(((double)klass->refresh_events - 1) / klass->refreshes_per_second)
+    );
+  }
 
   return suite;
 }
@@ -271,18 +1437,71 @@ void test_suite_run(TestSuite* suite) {
 void scenario_handler(const Scenario* scenario, TestSuite* suite) {
   EventClosure closure = {
     .suite = suite,
-    .curl  = curl_easy_init()
+    .node  = g_atomic_int_add(&suite->next_node, 1),
+    .curl  = scenario_curl_new(suite, TRUE),
+    .group = g_ptr_array_new_with_free_func((GDestroyNotify)curl_easy_cleanup)
   };
 
-  curlopt(closure.curl, CURLOPT_VERBOSE, 0);
-  curlopt(closure.curl, CURLOPT_WRITEFUNCTION, scenario_track_curl_write);
-  curlopt(closure.curl, CURLOPT_FOLLOWLOCATION, 1);
-  curlopt(closure.curl, CURLOPT_MAXREDIRS, 7);
+  ScenarioFinished* lifecycle = stats_scenario_finished_new(scenario);
+  lifecycle->node        = closure.node;
+  lifecycle->start       = g_get_monotonic_time();
+  lifecycle->restart     = lifecycle->start;
+  lifecycle->provisioned = TRUE;
+  lifecycle->target      = target_for_node(suite, closure.node);
+  sources_attach(closure.curl, suite, closure.node);
 
+restart:
   for (GList* entry = scenario->parts; entry; entry = entry->next) {
     ScenarioPart* part = entry->data;
-    g_ptr_array_foreach(part->events, (GFunc)scenario_run_event, &closure);
+    closure.part = part;
+
+    for (guint i = 0; i < part->events->len; ) {
+      const Event* event = g_ptr_array_index(part->events, i);
+      const Event* failed;
+
+      /* the events in a row that share a group run together */
+      guint last = i + 1;
+      while (event->group && last < part->events->len &&
+             ((Event*)g_ptr_array_index(part->events, last))->group == event->group)
+        ++last;
+
+      if (last - i > 1)
+        failed = scenario_run_group(part->events, i, last, &closure);
+      else
+        failed = scenario_run_event(event, &closure) ? NULL : event;
+
+      i = last;
+      if (g_atomic_int_get(&suite->aborting)) {
+        lifecycle->provisioned = FALSE;
+        goto aborted;
+      }
+      if (!failed)
+        continue;
+
+      /* out of retries: a node that reboots starts the scenario over, and
+       * anything else just carries on to the next request */
+      if (closure.reboots[failed->service] < suite->policies[failed->service].reboots) {
+        closure.reboots[failed->service] += 1;
+        closure.reboot                   += 1;
+        closure.previous                  = 0;
+        closure.finished                  = 0;
+
+        lifecycle->reboots     = closure.reboot;
+        lifecycle->restart     = g_get_monotonic_time();
+        lifecycle->provisioned = TRUE;
+        g_array_set_size(lifecycle->part_ends, 0);
+        goto restart;
+      }
+
+      lifecycle->provisioned = FALSE;
+    }
+
+    guint64 now = g_get_monotonic_time();
+    g_array_append_val(lifecycle->part_ends, now);
   }
 
+aborted:
+  stats_scenario_finished(suite->stats, lifecycle);
+  g_ptr_array_free(closure.group, TRUE);
   curl_easy_cleanup(closure.curl);
 }
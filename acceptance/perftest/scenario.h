@@ -2,22 +2,86 @@
 #define SCENARIO_H
 
 #include <glib.h>
+#include <curl/curl.h>
 
 typedef struct Event         Event;
 typedef struct ScenarioPart  ScenarioPart;
 typedef struct Scenario      Scenario;
+typedef struct NodeClass     NodeClass;
+typedef struct RetryPolicy   RetryPolicy;
+typedef struct Heartbeat     Heartbeat;
+typedef struct Target        Target;
+typedef struct Source        Source;
+typedef struct ReplayRequest ReplayRequest;
 typedef struct TestSuite     TestSuite;
 
+/** The Razor service an event talks to, used to pick a retry policy. */
+typedef enum Service {
+  SERVICE_API,
+  SERVICE_FILES,
+  SERVICE_TFTP,
+  SERVICE_UNKNOWN,
+  SERVICE_COUNT
+} Service;
+
+extern const char* service_names[SERVICE_COUNT];
+
+/** How a failed request is retried: the backoff between attempts. */
+typedef enum RetryBackoff {
+  RETRY_FIXED,
+  RETRY_EXPONENTIAL,
+  RETRY_JITTER
+} RetryBackoff;
+
+/** How requests are shared out when there is more than one target. */
+typedef enum TargetPolicy {
+  TARGET_STICKY,                /* a node sticks to one, by a hash of the node */
+  TARGET_ROUND_ROBIN,           /* each request to the next in turn */
+  TARGET_LEAST_OUTSTANDING      /* each request to the one with least in flight */
+} TargetPolicy;
+
+/** How long a node waits before an event, after the previous one ended. */
+typedef enum ThinkKind {
+  THINK_NONE,
+  THINK_FIXED,                  /* always min */
+  THINK_UNIFORM,                /* between min and max */
+  THINK_EXPONENTIAL             /* with a mean of min, limited to max */
+} ThinkKind;
+
+typedef struct Think {
+  ThinkKind kind;
+  guint64   min;                /* microseconds */
+  guint64   max;
+} Think;
+
+/** One request in a scenario file, compiled once and shared by every part
+ * and node that runs the file.  Strings are interned for the whole run.
+ */
 struct Event {
-  ScenarioPart* scenario_part;
-  const char*   url;
-  gboolean      expect_success;
+  const char*        url;       /* against the first target */
+  const char*        method;    /* NULL for GET, or HEAD without a body */
+  const char*        body;      /* NULL for none */
+  struct curl_slist* headers;   /* NULL for none */
+  const char*        group;     /* events in a row in a group run at once */
+  gboolean           expect_success;
+  guint64            delay;     /* microseconds after the previous event started */
+  Think              think;
+  Service            service;
+
+  /* for the reports, worked out once from the URL by event_set_url() */
+  const char*        scheme;    /* "" if the URL has none */
+  const char*        path;      /* without the query */
+  const char*        label;     /* the URL, escaped for XML */
+
+  /* the URL, and label, against each target in turn */
+  const char**       urls;
+  const char**       labels;
 };
 
 struct ScenarioPart {
   Scenario*   scenario;
   const char* name;
-  GPtrArray*  events;
+  GPtrArray*  events;           /* Event*, shared with other parts */
 };
 
 struct Scenario {
@@ -25,6 +89,68 @@ struct Scenario {
   GList*      parts;
 };
 
+/** One line of a replayed access log, placed on the timeline of the log. */
+struct ReplayRequest {
+  guint64     offset;           /* microseconds after the first line */
+  guint       node;             /* index of the client in suite->replay */
+  guint       event;            /* index in the events of its only part */
+
+  /* a node makes one request at a time, in the order of the log */
+  guint       next;             /* the node's following request, or G_MAXUINT */
+  gint        waiting;          /* atomically: being due, and the previous
+                                 * request finishing, still to happen */
+};
+
+/** Timeouts and retries for one service, modelled on the firmware and agent
+ * clients that talk to it.  All times are in milliseconds, zero for none.
+ */
+struct RetryPolicy {
+  guint        connect_timeout;
+  guint        timeout;
+  guint        attempts;        /* in total, including the first */
+  RetryBackoff backoff;
+  guint        delay;           /* before the first retry */
+  guint        max_delay;       /* limit on exponential backoff */
+  guint        reboots;         /* restarts after failing at this service */
+};
+
+/** A class of nodes - physical, virtual, or whatever the manifest defines -
+ * that share an arrival rate, and a weighted mix of scenarios run on refresh.
+ */
+struct NodeClass {
+  const char* name;
+  guint       nodes;
+  double      refresh_percent;
+  double      refreshes_per_second;
+  guint       refresh_events;
+
+  /* the scenarios nodes of this class run, and their cumulative weights */
+  GPtrArray*  scenarios;
+  GArray*     weights;
+  guint       total_weight;
+};
+
+/** The idle population: nodes sitting in the microkernel between refreshes,
+ * each checking in on a timer.  Every node shares one URL, with its hw_id
+ * placed between the prefix and suffix when the checkin is made.
+ */
+struct Heartbeat {
+  guint         nodes;          /* zero for no heartbeat load */
+  guint         interval;       /* milliseconds between checkins by a node */
+  guint         jitter;         /* milliseconds either side of the interval */
+  guint         concurrency;    /* checkins in flight at once, at most */
+  gchar**       url_prefixes;   /* for each target */
+  gchar**       url_suffixes;
+  ScenarioPart* part;           /* what every checkin is reported against */
+  Event*        event;
+};
+
+/** A Razor server replica, given with --target. */
+struct Target {
+  const char* name;             /* NULL if there is no --target */
+  gint        outstanding;      /* requests in flight, updated atomically */
+};
+
 struct TestSuite {
   struct Stats* stats;
   GThreadPool*  pool;
@@ -32,32 +158,167 @@ struct TestSuite {
 
   guint  max_cycles;
 
-  char*  target;
+  GPtrArray*   targets;         /* Target*, never empty */
+  TargetPolicy target_policy;
+  gint         next_target;     /* for round robin, updated atomically */
+  gint         next_node;       /* for sticky targets, updated atomically */
+  GPtrArray*   sources;         /* Source*, from --source; empty for none */
+
   guint  load;
-  guint  physical_nodes;
-  guint  virtual_nodes;
+  guint  population;
   guint  nodes;
-  double physical_refresh_percent;
-  double virtual_refresh_percent;
-  guint  virtual_per_physical;
 
-  double physical_refreshes_per_second;
-  guint  physical_refresh_events;
-  double virtual_refreshes_per_second;
-  guint  virtual_refresh_events;
+  char*  control;               /* Unix socket to accept commands on */
+
+  double refreshes_per_second;
 
   guint approximate_runtime;
 
+  /* measurement windowing: samples in the warm-up are excluded from the
+   * summary reports, as is anything outside a detected steady state */
+  guint    warmup_seconds;
+  guint    warmup_requests;
+  gboolean steady_state;
+  guint    steady_window;
+  double   steady_tolerance;
+
+  /* sampling of the raw per-request output: errors and anything slower than
+   * the percentile are always written, and the rest are sampled */
+  double   trace_rate;
+  guint    trace_limit;         /* per URL, zero for no limit */
+  double   trace_slow;
+  guint    report_benchmark;    /* made up requests to time the reports on */
+
   guint64 start_time;
   guint64 end_time;
+  gint    aborting;             /* set atomically once out of time */
+
+  /* replaying an access log, rather than running the manifest */
+  GPtrArray* replay;            /* Scenario*, one per node */
+  GArray*    replay_requests;   /* ReplayRequest, sorted by offset */
+  double     replay_speed;      /* multiplier, or zero for flat out */
+  guint      replay_concurrency;
+  gint       replay_started;    /* atomically, requests pushed to the pool */
+  gint       replay_stopped;    /* set atomically by the stop command */
 
-  Scenario* esxi;
-  Scenario* ubuntu;
+  RetryPolicy policies[SERVICE_COUNT];
+  Heartbeat   heartbeat;
+
+  GRand*     rand;
+  GPtrArray* scenarios;         /* Scenario*, as loaded from the manifest */
+  GPtrArray* classes;           /* NodeClass*, as loaded from the manifest */
 };
 
 
 TestSuite* test_suite_setup(int* argc, char*** argv);
 
+/**
+ * Select a scenario for a node of the given class, honouring the weights in
+ * the manifest.  Must only be called from the main loop thread.
+ * @param[in] klass  the class of node being refreshed.
+ * @param[in] suite  the test suite, used for random number generation.
+ * @returns the scenario to run, owned by the suite.
+ */
+Scenario* node_class_pick_scenario(const NodeClass* klass, TestSuite* suite);
+
+/**
+ * Replace the scenario mix of a node class.  Must only be called from the
+ * main loop thread, like node_class_pick_scenario().
+ * @param[in] klass  the class of node to change.
+ * @param[in] suite  the test suite, holding the scenarios.
+ * @param[in] mix    a NULL terminated list of "scenario:weight".
+ * @returns[caller frees] NULL on success, or why the mix was refused, in
+ * which case the class is unchanged.
+ */
+gchar* node_class_set_mix(NodeClass* klass, TestSuite* suite, gchar** mix);
+
+/**
+ * Work out which Razor service a URL talks to, by scheme and port.
+ * @param[in] url  the fully substituted URL.
+ * @returns the service.
+ */
+Service service_for_url(const char* url);
+
+/**
+ * Set the URL of an event against one target, along with everything derived
+ * from it: the service, and what the reports show.  Strings are interned for
+ * the run, and the work is done once for each distinct URL.  Must only be
+ * called while loading, before the run starts.
+ * @param[in] event   the event to change.
+ * @param[in] target  the index of the target the URL is for; the first sets
+ * the service, and the rest of what is shared by every target.
+ * @param[in] url     the fully substituted URL; copied.
+ */
+void event_set_url(Event* event, guint target, const char* url);
+
+/**
+ * Pick the target for a request, as the target policy says, and count it as
+ * in flight there until target_release().
+ * @param[in] suite  the test suite.
+ * @param[in] node   identifies the node making the request, for sticky
+ * targets; any number, so long as each node keeps to one.
+ * @returns the index of the target in suite->targets.
+ */
+guint target_acquire(TestSuite* suite, guint node);
+
+/**
+ * Count a request picked by target_acquire() as no longer in flight.
+ * @param[in] suite   the test suite.
+ * @param[in] target  the index of the target it went to.
+ */
+void target_release(TestSuite* suite, guint target);
+
+/**
+ * The target a node sticks to, or -1 if requests are shared out one at a
+ * time by the target policy.
+ * @param[in] suite  the test suite.
+ * @param[in] node   as given to target_acquire().
+ * @returns the index of the target in suite->targets, or -1.
+ */
+gint target_for_node(TestSuite* suite, guint node);
+
 void scenario_handler(const Scenario* scenario, TestSuite* suite);
 
+/**
+ * Create a curl handle set up as scenarios use them.  Its transfers give up
+ * once suite->aborting is set, whatever their timeouts.
+ * @param[in] suite  the test suite.
+ * @param[in] reuse  FALSE to open a new connection for every request, as a
+ * population of separate clients would.
+ * @returns[caller frees] the handle, for curl_easy_cleanup().
+ */
+CURL* scenario_curl_new(TestSuite* suite, gboolean reuse);
+
+/**
+ * Make a single attempt at an event, outside of any scenario, and report it
+ * as a heartbeat, which stats counts without keeping.
+ * @param[in] part    the part to report against.
+ * @param[in] event   the event to make, which sets the policy and options.
+ * @param[in] target  the index of the target the URL is for, from
+ * target_acquire(); released by the caller.
+ * @param[in] url     the URL to fetch, in place of the one in the event.
+ * @param[in] curl    a handle from scenario_curl_new(), owned by the caller.
+ * @param[in] suite   the test suite.
+ * @returns TRUE if the attempt was successful.
+ */
+gboolean scenario_run_once(
+  const ScenarioPart* part, const Event* event, guint target, const char* url,
+  CURL* curl, TestSuite* suite
+);
+
+/**
+ * Make an event for a node, outside of any scenario, retrying as the
+ * service policy says, and report every attempt.
+ * @param[in] part   the part to report against.
+ * @param[in] event  the event to make.
+ * @param[in] node   identifies the node, for sticky targets.
+ * @param[in] curl   a handle from scenario_curl_new(), owned by the caller.
+ * @param[in] suite  the test suite.
+ * @returns TRUE if the last attempt was successful.
+ */
+gboolean scenario_run_request(
+  const ScenarioPart* part, const Event* event, guint node, CURL* curl,
+  TestSuite* suite
+);
+
 #endif /* SCENARIO_H */
@@ -0,0 +1,366 @@
+#include "sources.h"
+
+#include <glib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the most addresses a single range may expand to */
+#define SOURCES_MAX_RANGE   65536
+
+/* /proc/net/tcp states, in hex */
+#define TCP_TIME_WAIT       0x06
+#define TCP_CLOSE           0x07
+#define TCP_LISTEN          0x0A
+
+static guint port_low  = 32768;
+static guint port_high = 60999;
+
+/** a target address and port that requests have been made to */
+typedef struct Destination {
+  int     family;
+  guint32 words[4];             /* the address, as /proc/net/tcp shows it */
+  guint   port;
+} Destination;
+
+/* learned from curl as requests finish, on any thread; there is one for
+ * each target and port, so the list stays short */
+static GMutex  destinations_lock;
+static GArray* destinations;
+
+/** what one sample counts, for each source */
+typedef struct Sample {
+  GArray* destinations;         /* a copy, so reading /proc holds no lock */
+  guint*  tuples;               /* for each source, then each destination */
+  guint*  in_use;
+  guint*  time_wait;
+} Sample;
+
+static void sources_add(TestSuite* suite, const struct sockaddr_storage* address, socklen_t length) {
+  char    text[INET6_ADDRSTRLEN];
+  Source* source = g_new0(Source, 1);
+
+  memcpy(&source->address, address, length);
+  source->length = length;
+  source->index  = suite->sources->len;
+
+  const void* raw = address->ss_family == AF_INET
+    ? (const void*)&((const struct sockaddr_in*)address)->sin_addr
+    : (const void*)&((const struct sockaddr_in6*)address)->sin6_addr;
+  inet_ntop(address->ss_family, raw, text, sizeof(text));
+  source->name      = g_strdup(text);
+  source->interface = g_strdup_printf("host!%s", text);
+
+  g_ptr_array_add(suite->sources, source);
+}
+
+static gboolean parse_ipv4(const char* text, struct in_addr* address) {
+  return inet_pton(AF_INET, text, address) == 1;
+}
+
+static void sources_load_entry(TestSuite* suite, const char* entry) {
+  struct sockaddr_storage address = { 0 };
+  struct sockaddr_in*     v4      = (struct sockaddr_in*)&address;
+  struct sockaddr_in6*    v6      = (struct sockaddr_in6*)&address;
+
+  const char* dash = strchr(entry, '-');
+  if (dash) {
+    gchar*         first = g_strndup(entry, dash - entry);
+    struct in_addr from, to;
+    gboolean       ok    = parse_ipv4(g_strstrip(first), &from) &&
+      parse_ipv4(dash + 1, &to) && ntohl(from.s_addr) <= ntohl(to.s_addr);
+    g_free(first);
+
+    if (!ok) {
+      g_critical("--source %s is not a range of IPv4 addresses", entry);
+      exit(1);
+    }
+    if (ntohl(to.s_addr) - ntohl(from.s_addr) >= SOURCES_MAX_RANGE) {
+      g_critical("--source %s has more than %d addresses", entry, SOURCES_MAX_RANGE);
+      exit(1);
+    }
+
+    v4->sin_family = AF_INET;
+    for (guint32 a = ntohl(from.s_addr); a <= ntohl(to.s_addr); ++a) {
+      v4->sin_addr.s_addr = htonl(a);
+      sources_add(suite, &address, sizeof(struct sockaddr_in));
+    }
+  } else if (parse_ipv4(entry, &v4->sin_addr)) {
+    v4->sin_family = AF_INET;
+    sources_add(suite, &address, sizeof(struct sockaddr_in));
+  } else if (inet_pton(AF_INET6, entry, &v6->sin6_addr) == 1) {
+    v6->sin6_family = AF_INET6;
+    sources_add(suite, &address, sizeof(struct sockaddr_in6));
+  } else {
+    g_critical("--source %s is not an IP address, or range of them", entry);
+    exit(1);
+  }
+}
+
+void sources_load(TestSuite* suite, const char* spec) {
+  suite->sources = g_ptr_array_new();
+
+  gchar* range = NULL;
+  if (g_file_get_contents("/proc/sys/net/ipv4/ip_local_port_range", &range, NULL, NULL)) {
+    guint low, high;
+    if (sscanf(range, "%u %u", &low, &high) == 2 && low <= high) {
+      port_low  = low;
+      port_high = high;
+    }
+    g_free(range);
+  }
+
+  if (!spec)
+    return;
+
+  gchar** entries = g_strsplit(spec, ",", -1);
+  for (int i = 0; entries[i]; ++i)
+    if (*g_strstrip(entries[i]) != '\0')
+      sources_load_entry(suite, entries[i]);
+  g_strfreev(entries);
+}
+
+guint sources_port_range(void) {
+  return port_high - port_low + 1;
+}
+
+/* curl calls this for every connection the handle makes */
+static curl_socket_t sources_open_socket(
+  void* data, curlsocktype purpose, struct curl_sockaddr* address
+) {
+  Source* source = data;
+  int     fd     = socket(address->family, address->socktype, address->protocol);
+  if (fd < 0)
+    return CURL_SOCKET_BAD;
+
+  /* a target of the other address family is reached from wherever the
+   * kernel likes; UDP is bound by curl, through sources_prepare() */
+  if (purpose == CURLSOCKTYPE_IPCXN && address->socktype == SOCK_STREAM &&
+      address->family == source->address.ss_family) {
+#ifdef IP_BIND_ADDRESS_NO_PORT
+    /* otherwise bind() takes a port for this address alone, and a source
+     * runs out after one port range's worth of connections, whatever the
+     * target; this leaves the choice until connect() */
+    int one = 1;
+    setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+#endif
+    if (bind(fd, (struct sockaddr*)&source->address, source->length) != 0) {
+      g_atomic_int_inc(&source->bind_failures);
+      close(fd);
+      return CURL_SOCKET_BAD;
+    }
+  }
+
+  g_atomic_int_inc(&source->sockets);
+  return fd;
+}
+
+void sources_attach(CURL* curl, TestSuite* suite, guint node) {
+  if (suite->sources->len == 0)
+    return;
+
+  Source* source = g_ptr_array_index(suite->sources, node % suite->sources->len);
+  curl_easy_setopt(curl, CURLOPT_OPENSOCKETFUNCTION, sources_open_socket);
+  curl_easy_setopt(curl, CURLOPT_OPENSOCKETDATA, source);
+  curl_easy_setopt(curl, CURLOPT_PRIVATE, source);
+}
+
+static Source* sources_of(CURL* curl) {
+  char* source = NULL;
+  curl_easy_getinfo(curl, CURLINFO_PRIVATE, &source);
+  return (Source*)source;
+}
+
+void sources_prepare(CURL* curl, const Event* event) {
+  Source* source = sources_of(curl);
+  if (source)
+    curl_easy_setopt(
+      curl, CURLOPT_INTERFACE,
+      event->service == SERVICE_TFTP ? source->interface : NULL
+    );
+}
+
+gint sources_index(CURL* curl) {
+  Source* source = sources_of(curl);
+  return source ? (gint)source->index : -1;
+}
+
+static gint destinations_find(
+  GArray* array, int family, const guint32* words, guint port
+) {
+  for (guint i = 0; i < array->len; ++i) {
+    const Destination* destination = &g_array_index(array, Destination, i);
+    if (destination->family == family && destination->port == port &&
+        memcmp(destination->words, words, family == AF_INET ? 4 : 16) == 0)
+      return i;
+  }
+
+  return -1;
+}
+
+void sources_learn(CURL* curl) {
+  char* ip   = NULL;
+  long  port = 0;
+  if (curl_easy_getinfo(curl, CURLINFO_PRIMARY_IP, &ip) != CURLE_OK || !ip ||
+      curl_easy_getinfo(curl, CURLINFO_PRIMARY_PORT, &port) != CURLE_OK || port <= 0)
+    return;
+
+  /* inet_pton() leaves the address in network order, which is how the
+   * kernel's words compare, as for sources_find() */
+  Destination destination;
+  memset(&destination, 0, sizeof(destination));
+  destination.port = port;
+  if (inet_pton(AF_INET, ip, destination.words) == 1)
+    destination.family = AF_INET;
+  else if (inet_pton(AF_INET6, ip, destination.words) == 1)
+    destination.family = AF_INET6;
+  else
+    return;
+
+  g_mutex_lock(&destinations_lock);
+  if (!destinations)
+    destinations = g_array_new(FALSE, FALSE, sizeof(Destination));
+  if (destinations_find(destinations, destination.family, destination.words,
+                        destination.port) < 0)
+    g_array_append_val(destinations, destination);
+  g_mutex_unlock(&destinations_lock);
+}
+
+/* "0100007F:1F90", or 32 hex digits for IPv6, as the kernel prints the
+ * address a word at a time in host order; the words are compared the same
+ * way, so there is no need to swap them */
+static gboolean parse_proc_address(
+  const char* text, guint32* words, guint count, guint* port
+) {
+  char* end = NULL;
+  for (guint i = 0; i < count; ++i) {
+    char word[9];
+    memcpy(word, text + i * 8, 8);
+    word[8]  = '\0';
+    words[i] = strtoul(word, &end, 16);
+    if (end != word + 8)
+      return FALSE;
+  }
+
+  if (text[count * 8] != ':')
+    return FALSE;
+  *port = strtoul(text + count * 8 + 1, &end, 16);
+  return TRUE;
+}
+
+static gint sources_find(TestSuite* suite, int family, const guint32* words) {
+  if (suite->sources->len == 0)
+    return 0;
+
+  /* a linear search, but only once a second on the stats thread */
+  for (guint i = 0; i < suite->sources->len; ++i) {
+    Source* source = g_ptr_array_index(suite->sources, i);
+    if (source->address.ss_family != family)
+      continue;
+
+    if (family == AF_INET) {
+      const struct sockaddr_in* v4 = (const struct sockaddr_in*)&source->address;
+      if (memcmp(&v4->sin_addr, words, 4) == 0)
+        return i;
+    } else {
+      const struct sockaddr_in6* v6 = (const struct sockaddr_in6*)&source->address;
+      if (memcmp(&v6->sin6_addr, words, 16) == 0)
+        return i;
+    }
+  }
+
+  return -1;
+}
+
+static void sources_sample_file(
+  TestSuite* suite, const char* filename, int family, Sample* sample
+) {
+  FILE* file = fopen(filename, "r");
+  if (!file)
+    return;
+
+  const guint count = family == AF_INET ? 1 : 4;
+  char        line[512];
+
+  /* the first line is a header */
+  if (!fgets(line, sizeof(line), file)) {
+    fclose(file);
+    return;
+  }
+
+  /* "  sl  local_address rem_address   st ..." */
+  while (fgets(line, sizeof(line), file)) {
+    char*   local = strchr(line, ':');
+    guint32 words[4], remote_words[4];
+    guint   port, remote_port;
+    if (!local || !parse_proc_address(local + 2, words, count, &port))
+      continue;
+
+    /* the remote address, then the state */
+    char* remote = local + 2 + count * 8 + 6;
+    if (!parse_proc_address(remote, remote_words, count, &remote_port))
+      continue;
+    char* state = strchr(remote, ' ');
+    if (!state)
+      continue;
+
+    guint st = strtoul(state + 1, NULL, 16);
+    if (st == TCP_LISTEN || st == TCP_CLOSE || port < port_low || port > port_high)
+      continue;
+
+    gint index = sources_find(suite, family, words);
+    if (index < 0)
+      continue;
+
+    /* anything else on the host, to anywhere else, is none of ours */
+    gint destination = destinations_find(
+      sample->destinations, family, remote_words, remote_port
+    );
+    if (destination < 0)
+      continue;
+
+    sample->tuples[index * sample->destinations->len + destination] += 1;
+    sample->in_use[index]    += 1;
+    sample->time_wait[index] += st == TCP_TIME_WAIT ? 1 : 0;
+  }
+
+  fclose(file);
+}
+
+void sources_sample(
+  TestSuite* suite, guint* in_use, guint* time_wait, guint* busiest
+) {
+  const guint count = MAX(suite->sources->len, 1);
+  memset(in_use, 0, count * sizeof(guint));
+  memset(time_wait, 0, count * sizeof(guint));
+  memset(busiest, 0, count * sizeof(guint));
+
+  Sample sample = { .in_use = in_use, .time_wait = time_wait };
+  g_mutex_lock(&destinations_lock);
+  sample.destinations = g_array_new(FALSE, FALSE, sizeof(Destination));
+  if (destinations)
+    g_array_append_vals(sample.destinations, destinations->data, destinations->len);
+  g_mutex_unlock(&destinations_lock);
+
+  /* nothing has connected yet */
+  if (sample.destinations->len == 0) {
+    g_array_free(sample.destinations, TRUE);
+    return;
+  }
+
+  const guint targets = sample.destinations->len;
+  sample.tuples = g_new0(guint, count * targets);
+  sources_sample_file(suite, "/proc/net/tcp", AF_INET, &sample);
+  sources_sample_file(suite, "/proc/net/tcp6", AF_INET6, &sample);
+
+  for (guint i = 0; i < count; ++i)
+    for (guint d = 0; d < targets; ++d)
+      busiest[i] = MAX(busiest[i], sample.tuples[i * targets + d]);
+
+  g_free(sample.tuples);
+  g_array_free(sample.destinations, TRUE);
+}
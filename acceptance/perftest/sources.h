@@ -0,0 +1,102 @@
+#ifndef SOURCES_H
+#define SOURCES_H
+
+#include "scenario.h"
+
+#include <glib.h>
+#include <curl/curl.h>
+#include <sys/socket.h>
+
+/** A local address that requests are made from, given with --source. */
+struct Source {
+  const char*             name;
+  guint                   index;      /* in suite->sources */
+  struct sockaddr_storage address;    /* with a port of zero */
+  socklen_t               length;
+  gchar*                  interface;  /* for CURLOPT_INTERFACE */
+
+  /* updated atomically, from any thread opening a socket */
+  gint                    sockets;    /* opened, over the whole run */
+  gint                    bind_failures;
+};
+
+/**
+ * Load the pool of local addresses to make requests from.
+ *
+ * Each entry is an IPv4 or IPv6 address, or an inclusive range of IPv4
+ * addresses such as "127.0.1.1-127.0.1.254", separated by commas.  The
+ * addresses must already be configured on the host - as loopback aliases,
+ * or extra addresses on an interface - since nothing here adds them.
+ *
+ * @param[in] suite  the test suite; suite->sources is filled in.
+ * @param[in] spec   the list of addresses, or NULL to let the kernel pick
+ * the source of every connection, as it otherwise would.
+ */
+void sources_load(TestSuite* suite, const char* spec);
+
+/**
+ * Make a handle open its sockets from the source address of a node.  Nodes
+ * are spread evenly over the pool, and keep to their address, as a real
+ * client would.  TCP sockets are bound without a port, so that the kernel
+ * still shares ports between connections to different targets.  Does
+ * nothing if there is no pool.
+ *
+ * @param[in] curl   the handle, which may have been attached before.
+ * @param[in] suite  the test suite.
+ * @param[in] node   identifies the node that the handle makes requests for.
+ */
+void sources_attach(CURL* curl, TestSuite* suite, guint node);
+
+/**
+ * Set up a handle for the protocol of an event.  TFTP is made over UDP,
+ * which curl binds for itself, so the source address is given to curl,
+ * rather than bound when the socket is opened.
+ *
+ * @param[in] curl   the handle, after any sources_attach().
+ * @param[in] event  the event about to be made.
+ */
+void sources_prepare(CURL* curl, const Event* event);
+
+/**
+ * The source a handle was attached to.
+ * @param[in] curl  the handle.
+ * @returns the index of the source in suite->sources, or -1 for none.
+ */
+gint sources_index(CURL* curl);
+
+/**
+ * The number of ephemeral ports the kernel picks from, for each source
+ * address and target.
+ */
+guint sources_port_range(void);
+
+/**
+ * Note the target address and port a handle last connected to, so that
+ * sources_sample() can tell the sockets of the run from the rest of the
+ * host.  Call after each request; safe from any thread.
+ *
+ * @param[in] curl  the handle, once the request has finished.
+ */
+void sources_learn(CURL* curl);
+
+/**
+ * Count the TCP sockets using an ephemeral port, and those of them in
+ * TIME_WAIT, from each source address to the targets, as /proc/net/tcp
+ * shows them.  Only destinations that sources_learn() has seen are counted,
+ * so other processes on the host are left out.  With no pool, every source
+ * address counts against one entry.
+ *
+ * The kernel runs out of ports for each source and destination pair, so
+ * busiest is the most sockets from a source to any one target address and
+ * port, and the measure of how close it is to running out.
+ *
+ * @param[in]  suite      the test suite.
+ * @param[out] in_use     one for each source, or one for no pool; zeroed.
+ * @param[out] time_wait  as in_use.
+ * @param[out] busiest    as in_use.
+ */
+void sources_sample(
+  TestSuite* suite, guint* in_use, guint* time_wait, guint* busiest
+);
+
+#endif /* SOURCES_H */
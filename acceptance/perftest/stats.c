@@ -1,24 +1,80 @@
 #include "stats.h"
+#include "sources.h"
 
 #include <glib.h>
-#include <uriparser/Uri.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <math.h>
+
+/** retry and timeout totals for one service, across the whole run */
+typedef struct ServiceTotals {
+  guint   logical;
+  guint   attempts;
+  guint   retries;
+  guint   reboot_attempts;
+  guint   timeouts;
+  guint   errors;
+} ServiceTotals;
+
+/** connections from one source address, across the whole run */
+typedef struct SourceTotals {
+  guint   attempts;
+  guint   connect_failures;
+  guint   peak_sockets;
+  guint   peak_time_wait;
+  guint   peak_busiest;         /* to any one target address and port */
+} SourceTotals;
 
 struct Stats {
   TestSuite*    suite;
+
+  /* the recording thread; NULL once reporting has started, guarded by the
+   * lock, since reporters on other threads may still be finishing */
+  GMutex        lock;
   GThreadPool*  pool;
 
+  /* reads /proc/net/tcp, which can take a while under port pressure, apart
+   * from the recording thread; sampling is set atomically during a scan */
+  GThreadPool*  sampler;
+  gint          sampling;
+
   /* data relating to individual URL fetch performance, and group fetch
    * performance, indexed by the name of what was fetched */
   GTree*        by_url;
   GTree*        by_scenario_part;
   GTree*        by_scenario;
 
+  /* node lifecycles, indexed by scenario name */
+  GTree*        by_lifecycle;
+
   /* data related to concurrency, indexed by time, sampled through the life of
    * the run */
   GPtrArray*    concurrency;
+
+  /* per second interval stats, indexed by seconds since the start of the
+   * run, and markers recorded against the same timeline */
+  GArray*       intervals;
+  GPtrArray*    markers;
+
+  /* SERVICE_COUNT for each target in turn, through stats_service_totals() */
+  ServiceTotals* services;
+
+  /* for each source address, or just one if there is no pool */
+  SourceTotals* sources;
+  gboolean      pressure_warned;
+
+  /* the measurement window, from warm-up and steady state detection */
+  guint         finished;
+  guint64       steady_start;
+  guint64       steady_end;
+
+  /* where reports are written, or NULL for the working directory */
+  const char*   output_dir;
+
+  /* samples written to the raw network reports, of all those recorded */
+  guint         trace_kept;
+  guint         trace_total;
 };
 
 typedef struct StatsEvent {
@@ -27,9 +83,23 @@ typedef struct StatsEvent {
 } StatsEvent;
 
 static void stats_handler(StatsEvent* event, Stats* stats);
-static void stats_send_event(GThreadPool* pool, StatsEventFunc handler, gpointer data);
+static void stats_send_event(
+  Stats* stats, StatsEventFunc handler, GDestroyNotify destroy, gpointer data
+);
+static void event_finished_free(EventFinished* data);
+static void scenario_finished_free(ScenarioFinished* data);
+static void concurrency_free(gpointer data);
+static void marker_free(gpointer data);
+static void socket_sample_free(gpointer data);
+static void stats_sampler(gpointer data, Stats* stats);
 static void stats_record_event_finished(Stats* stats, EventFinished* event);
+static void stats_record_heartbeat_finished(Stats* stats, EventFinished* event);
 static void stats_record_concurrency(Stats* stats, gpointer data);
+static void stats_record_marker(Stats* stats, gpointer data);
+static void stats_record_scenario_finished(Stats* stats, ScenarioFinished* data);
+static void stats_record_snapshot(Stats* stats, gpointer data);
+static void stats_record_sockets(Stats* stats, gpointer data);
+static FILE* stats_fopen(Stats* stats, const char* name);
 
 static inline EventFinished* event_finished_array_get(GPtrArray* array, guint index) {
   return (EventFinished*)g_ptr_array_index(array, index);
@@ -43,21 +113,8 @@ static inline gdouble relative_time(guint64 start, guint64 event) {
   return when / 1000000;
 }
 
-static gint compare_pointer(gconstpointer a, gconstpointer b);
-
-/** as much URI as we need to parse here... */
-typedef struct URI {
-  const char* scheme;
-  const char* user;
-  const char* host;
-  guint       port;
-  const char* path;
-  const char* query;
-  const char* fragment;
-} URI;
-
-static URI* parse_uri(const char* uri);
-static void free_uri(URI* uri);
+static gint compare_scenario_name(gconstpointer a, gconstpointer b);
+static gint compare_part_name(gconstpointer a, gconstpointer b);
 
 /************************************************************************
  * Private types
@@ -67,8 +124,95 @@ typedef struct ConcurrencyClosure {
   guint   pending;
   guint   running;
   guint   queued;
+  gint*   outstanding;          /* requests in flight at each target */
 } ConcurrencyClosure;
 
+/* the sockets counted by one scan, for each source address */
+typedef struct SocketSample {
+  guint64 when;
+  guint*  in_use;
+  guint*  time_wait;
+  guint*  busiest;              /* to any one target address and port */
+} SocketSample;
+
+typedef struct TargetInterval {
+  guint   requests;
+  guint   errors;
+  gdouble latency;
+} TargetInterval;
+
+typedef struct Interval {
+  guint   requests;
+  guint   errors;
+  guint64 bytes;
+  gdouble latency;              /* sum of total request time, in seconds */
+
+  guint   provisioned;          /* nodes that finished their scenario */
+
+  /* checkins from the idle population, kept apart from the totals above */
+  guint   heartbeats;
+  guint   heartbeat_errors;
+  gdouble heartbeat_latency;
+
+  /* every attempt, against the logical requests made by nodes */
+  guint   attempts[SERVICE_COUNT];
+  guint   logical[SERVICE_COUNT];
+
+  /* for each target, or NULL until a request finishes in the interval */
+  TargetInterval* targets;
+
+  /* connections, and the ephemeral ports they use, from all sources */
+  guint   connect_failures;
+  guint   sockets;
+  guint   time_wait;
+  gdouble port_pressure;        /* the most any source had to one target */
+} Interval;
+
+typedef struct Marker {
+  guint64 when;
+  gchar*  text;
+} Marker;
+
+/** where a sample falls relative to the measurement window */
+typedef enum SamplePhase {
+  PHASE_WARMUP,
+  PHASE_MEASURED,
+  PHASE_COOLDOWN
+} SamplePhase;
+
+static const char* phase_names[] = { "warmup", "measured", "cooldown" };
+
+static SamplePhase sample_phase(Stats* stats, const EventFinished* record);
+static SamplePhase lifecycle_phase(Stats* stats, const ScenarioFinished* record);
+static Interval*   stats_interval(Stats* stats, guint64 when);
+
+static inline ServiceTotals* stats_service_totals(
+  Stats* stats, guint target, Service service
+) {
+  return &stats->services[target * SERVICE_COUNT + service];
+}
+
+static inline const char* target_name(Stats* stats, guint target) {
+  const Target* t = g_ptr_array_index(stats->suite->targets, target);
+  return t->name ? t->name : "none";
+}
+
+/** A large buffer in front of a report file, for the reports that write a
+ * line per request; formatting is done by hand, since printf dominates the
+ * time spent writing them otherwise. */
+typedef struct Writer {
+  FILE*    file;
+  GString* buffer;
+} Writer;
+
+#define WRITER_BUFFER (1 << 20)
+
+static Writer* writer_new(FILE* file);
+static void    writer_close(Writer* writer);
+static void    writer_string(Writer* writer, const char* text);
+static void    writer_uint(Writer* writer, guint64 value);
+static void    writer_seconds(Writer* writer, guint64 start, guint64 event);
+
 /**************************************************************************
  * Public interface
  */
@@ -76,21 +220,55 @@ Stats* stats_new(TestSuite* suite) {
   Stats* stats            = g_new0(Stats, 1);
   stats->suite            = suite;
   stats->by_url           = g_tree_new((GCompareFunc)g_strcmp0);
-  stats->by_scenario_part = g_tree_new(compare_pointer);
-  stats->by_scenario      = g_tree_new(compare_pointer);
+  stats->by_scenario_part = g_tree_new(compare_part_name);
+  stats->by_scenario      = g_tree_new(compare_scenario_name);
+  stats->by_lifecycle     = g_tree_new((GCompareFunc)g_strcmp0);
   stats->concurrency      = g_ptr_array_new();
+  stats->intervals        = g_array_new(FALSE, TRUE, sizeof(Interval));
+  stats->markers          = g_ptr_array_new();
+  stats->services         = g_new0(ServiceTotals, suite->targets->len * SERVICE_COUNT);
+  stats->sources          = g_new0(SourceTotals, MAX(suite->sources->len, 1));
   stats->pool             = g_thread_pool_new((GFunc)stats_handler, stats, 1, TRUE, NULL);
+  stats->sampler          = g_thread_pool_new((GFunc)stats_sampler, stats, 1, FALSE, NULL);
+  g_mutex_init(&stats->lock);
   return stats;
 }
 
-EventFinished* stats_event_finished_new(const Event* event) {
+EventFinished* stats_event_finished_new(const Event* event, const ScenarioPart* part) {
   EventFinished* data = g_slice_new0(EventFinished);
-  data->event = event;
+  data->event  = event;
+  data->part   = part;
+  data->source = -1;
   return data;
 }
 
 void stats_event_finished(Stats* stats, EventFinished* data) {
-  stats_send_event(stats->pool, (StatsEventFunc)stats_record_event_finished, data);
+  stats_send_event(
+    stats, (StatsEventFunc)stats_record_event_finished,
+    (GDestroyNotify)event_finished_free, data
+  );
+}
+
+void stats_heartbeat_finished(Stats* stats, EventFinished* data) {
+  stats_send_event(
+    stats, (StatsEventFunc)stats_record_heartbeat_finished,
+    (GDestroyNotify)event_finished_free, data
+  );
+}
+
+ScenarioFinished* stats_scenario_finished_new(const Scenario* scenario) {
+  ScenarioFinished* data = g_slice_new0(ScenarioFinished);
+  data->scenario  = scenario;
+  data->part_ends = g_array_new(FALSE, FALSE, sizeof(guint64));
+  data->target    = -1;
+  return data;
+}
+
+void stats_scenario_finished(Stats* stats, ScenarioFinished* data) {
+  stats_send_event(
+    stats, (StatsEventFunc)stats_record_scenario_finished,
+    (GDestroyNotify)scenario_finished_free, data
+  );
 }
 
 void stats_report_concurrency(Stats* stats, guint pending, guint running, guint queued) {
@@ -101,252 +279,1005 @@ void stats_report_concurrency(Stats* stats, guint pending, guint running, guint
   data->running = running;
   data->queued  = queued;
 
-  stats_send_event(stats->pool, (StatsEventFunc)stats_record_concurrency, data);
+  GPtrArray* targets = stats->suite->targets;
+  data->outstanding  = g_new(gint, targets->len);
+  for (guint i = 0; i < targets->len; ++i)
+    data->outstanding[i] =
+      g_atomic_int_get(&((Target*)g_ptr_array_index(targets, i))->outstanding);
+
+  stats_send_event(
+    stats, (StatsEventFunc)stats_record_concurrency, concurrency_free, data
+  );
+}
+
+void stats_report_marker(Stats* stats, const char* text) {
+  Marker* data = g_slice_new(Marker);
+
+  data->when = g_get_monotonic_time();
+  data->text = g_strdup(text);
+
+  stats_send_event(
+    stats, (StatsEventFunc)stats_record_marker, marker_free, data
+  );
+}
+
+void stats_sample_sockets(Stats* stats) {
+  /* a scan still running from the last second covers this one too */
+  if (!stats->sampler || !g_atomic_int_compare_and_exchange(&stats->sampling, 0, 1))
+    return;
+
+  const guint   count  = MAX(stats->suite->sources->len, 1);
+  SocketSample* sample = g_slice_new(SocketSample);
+  sample->in_use       = g_new(guint, count);
+  sample->time_wait    = g_new(guint, count);
+  sample->busiest      = g_new(guint, count);
+  g_thread_pool_push(stats->sampler, sample, NULL);
+}
+
+void stats_snapshot(Stats* stats, const char* dirname) {
+  stats_send_event(stats, stats_record_snapshot, g_free, g_strdup(dirname));
 }
 
 static void write_concurrency(Stats *stats) {
-  FILE* c = fopen("concurrency.csv", "wb");
-  fprintf(c, "when, running, pending, queued\n");
-  fprintf(c, "0.0, 0, 0, 0\n"); /* start at zero! */
+  const guint targets = stats->suite->targets->len;
+
+  FILE* c = stats_fopen(stats, "concurrency.csv");
+  fprintf(c, "when, running, pending, queued");
+  for (guint t = 0; t < targets; ++t)
+    fprintf(c, ", %s_outstanding", target_name(stats, t));
+  fprintf(c, "\n");
+
+  fprintf(c, "0.0, 0, 0, 0"); /* start at zero! */
+  for (guint t = 0; t < targets; ++t)
+    fprintf(c, ", 0");
+  fprintf(c, "\n");
+
   for (int i = 0; i < stats->concurrency->len; ++i) {
     ConcurrencyClosure* data = stats->concurrency->pdata[i];
     fprintf(
-      c, "%f, %d, %d, %d\n",
+      c, "%f, %d, %d, %d",
       relative_time(stats->suite->start_time, data->when),
       data->running, data->pending, data->queued
     );
+    for (guint t = 0; t < targets; ++t)
+      fprintf(c, ", %d", data->outstanding[t]);
+    fprintf(c, "\n");
   }
   fclose(c);
 }
 
+static gint compare_double(gconstpointer a, gconstpointer b) {
+  const gdouble* x = a;
+  const gdouble* y = b;
+  return *x < *y ? -1 : (*x > *y ? 1 : 0);
+}
+
+/** nearest-rank percentile of a sorted array of doubles */
+static gdouble percentile(GArray* sorted, gdouble p) {
+  if (sorted->len == 0)
+    return 0;
+
+  guint rank = ceil(p / 100 * sorted->len);
+  return g_array_index(sorted, gdouble, CLAMP(rank, 1, sorted->len) - 1);
+}
+
 typedef struct WriteNetworkClosure {
-  FILE*        csv;
+  Stats*       stats;
+  Writer*      csv;
   GHashTable*  jtl;
+  GRand*       rand;
+  guint        kept;
+  guint        total;
 } WriteNetworkClosure;
 
-static FILE* get_jtl_file_handle(
-  GHashTable* table, const gchar* scenario, const gchar* part, const gchar* service
+static Writer* get_jtl_file_handle(
+  Stats* stats, GHashTable* table,
+  const gchar* scenario, const gchar* part, const gchar* service
 ) {
   gchar* filename = g_strdup_printf("%s-%s-%s.jtl", scenario, part, service);
 
-  FILE* result = g_hash_table_lookup(table, filename);
+  Writer* result = g_hash_table_lookup(table, filename);
   if (result) {
     g_free(filename);
     return result;
   }
 
-  result = fopen(filename, "wb");
-  if (!result) {
-    g_critical("can't open %s for output: %s", filename, strerror(errno));
-    exit(1);
-  }
-
   /* the hash table now owns the filename string */
+  result = writer_new(stats_fopen(stats, filename));
   g_hash_table_insert(table, filename, result);
 
   /* the file header... */
-  fprintf(result, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-  fprintf(result, "<testResults version=\"2.1\">\n");
+  writer_string(result, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+  writer_string(result, "<testResults version=\"2.1\">\n");
 
   return result;
 }
 
 static void close_jtl_file(gpointer data_) {
-  FILE* jtl = data_;
-  fprintf(jtl, "</testResults>\n");
-  fclose(jtl);
+  Writer* jtl = data_;
+  writer_string(jtl, "</testResults>\n");
+  writer_close(jtl);
 }
 
-static gboolean entity_replace_callback(
-  const GMatchInfo *info,
-  GString          *result,
-  gpointer         data_
+/* Choose the samples of one URL to write, returning the weight of each: the
+ * number of samples it stands for, or zero to leave it out.  Errors, and
+ * anything slower than the trace percentile, are always kept; the rest are
+ * reservoir sampled down to the trace rate, and limit.  Weights are whole
+ * numbers that add up to the samples there were, so totals estimated from
+ * the trace are exact.
+ *
+ * This runs as the reports are written, with every sample still held for the
+ * summaries, so sampling saves space on disk, not in memory. */
+static guint* trace_sample_weights(
+  WriteNetworkClosure* closure, GPtrArray* samples
 ) {
-  gchar* match = g_match_info_fetch(info, 0);
-
-  switch (match[0]) {
-  case '\'':
-    g_string_append(result, "&apos;");
-    break;
-  case '"':
-    g_string_append(result, "&quot;");
-    break;
-  case '>':
-    g_string_append(result, "&gt;");
-    break;
-  case '<':
-    g_string_append(result, "&lt;");
-    break;
-  case '&':
-    g_string_append(result, "&amp;");
-    break;
-  default:
-    g_print("unknown entity replacement '%s'", match);
-    exit(1);
+  TestSuite* suite   = closure->stats->suite;
+  guint*     weights = g_new0(guint, samples->len);
+
+  GArray* totals = g_array_sized_new(FALSE, FALSE, sizeof(gdouble), samples->len);
+  for (guint i = 0; i < samples->len; ++i) {
+    EventFinished* record = samples->pdata[i];
+    gdouble        total  = relative_time(record->start, record->finish);
+    g_array_append_val(totals, total);
+  }
+  g_array_sort(totals, compare_double);
+  const gdouble slow = percentile(totals, suite->trace_slow);
+  g_array_free(totals, TRUE);
+
+  GArray* ordinary = g_array_new(FALSE, FALSE, sizeof(guint));
+  for (guint i = 0; i < samples->len; ++i) {
+    EventFinished* record = samples->pdata[i];
+    if (!record->successful || relative_time(record->start, record->finish) > slow)
+      weights[i] = 1;
+    else
+      g_array_append_val(ordinary, i);
+  }
+
+  guint keep = ceil(suite->trace_rate * ordinary->len);
+  if (suite->trace_limit)
+    keep = MIN(keep, suite->trace_limit);
+
+  /* algorithm R: the first to fill the reservoir, then each replacing a
+   * random member with a falling probability */
+  guint* reservoir = g_new(guint, MAX(keep, 1));
+  for (guint i = 0; i < ordinary->len; ++i) {
+    guint index = g_array_index(ordinary, guint, i);
+    if (i < keep) {
+      reservoir[i] = index;
+    } else {
+      guint slot = g_rand_int_range(closure->rand, 0, i + 1);
+      if (slot < keep)
+        reservoir[slot] = index;
+    }
   }
 
-  g_free(match);
-  return FALSE;                 /* continue replacing */
+  /* each stands for an equal share of the ordinary samples, with what
+   * does not divide evenly carried by the first of them, one apiece */
+  for (guint i = 0; i < keep; ++i)
+    weights[reservoir[i]] = ordinary->len / keep + (i < ordinary->len % keep ? 1 : 0);
+
+  g_free(reservoir);
+  g_array_free(ordinary, TRUE);
+  return weights;
 }
 
 static gboolean write_network_url_entry(
   gpointer key_, gpointer value_, gpointer data_
 ) {
-  const char*          url     = key_;
   GPtrArray*           samples = value_;
   WriteNetworkClosure* closure = data_;
 
-  URI* uri = parse_uri(url);
-
-  const char* service = "unknown";
-  switch (uri->port) {
-  case 8026:
-    service = "api";
-    break;
-  case 8027:
-    service = "files";
-    break;
-  default:
-    if (!uri->scheme)
-      service = "undefined";
-    else if (g_ascii_strcasecmp(uri->scheme, "tftp") == 0)
-      service = "tftp";
-    break;
-  }
-
-  /** @todo danielp 2012-10-11: this should be pre-decoded for us, maybe? */
-  GError* error = NULL;
-  GRegex *entities = g_regex_new("['\"><&]", 0, 0, &error);
-  if (!entities || error) {
-    g_print("failed to compile entity regex: %s", error->message);
-    exit(1);
-  }
+  /* every sample is of the same URL, and so the same target, so they
+   * describe it the same way */
+  const EventFinished* first   = event_finished_array_get(samples, 0);
+  const Event*         event   = first->event;
+  const char*          service = service_names[event->service];
+  const char*          target  = target_name(closure->stats, first->target);
+  const char*          label   = event->labels[first->target];
+  guint*               weights = trace_sample_weights(closure, samples);
 
   for (int i = 0; i < samples->len; ++i) {
     EventFinished* record = samples->pdata[i];
-    const Event*   event  = record->event;
-    fprintf(
-      closure->csv, "%s, %s, %s, %s, %s, %f, %f\n",
-      event->scenario_part->scenario->name, event->scenario_part->name,
-      uri->scheme, service, uri->path,
-      relative_time(record->start, record->first_data),
-      relative_time(record->start, record->finish)
-    );
-
-    FILE* jtl = get_jtl_file_handle(
-      closure->jtl,
-      event->scenario_part->scenario->name, event->scenario_part->name,
+    closure->total += 1;
+    if (weights[i] == 0)
+      continue;
+    closure->kept += 1;
+
+    /* scenario, part, target, scheme, service, path, first_byte, total,
+     * phase, weight */
+    Writer* csv = closure->csv;
+    writer_string(csv, record->part->scenario->name);
+    writer_string(csv, ", ");
+    writer_string(csv, record->part->name);
+    writer_string(csv, ", ");
+    writer_string(csv, target);
+    writer_string(csv, ", ");
+    writer_string(csv, event->scheme);
+    writer_string(csv, ", ");
+    writer_string(csv, service);
+    writer_string(csv, ", ");
+    writer_string(csv, event->path);
+    writer_string(csv, ", ");
+    writer_seconds(csv, record->start, record->first_data);
+    writer_string(csv, ", ");
+    writer_seconds(csv, record->start, record->finish);
+    writer_string(csv, ", ");
+    writer_string(csv, phase_names[sample_phase(closure->stats, record)]);
+    writer_string(csv, ", ");
+    writer_uint(csv, weights[i]);
+    writer_string(csv, "\n");
+
+    Writer* jtl = get_jtl_file_handle(
+      closure->stats, closure->jtl,
+      record->part->scenario->name, record->part->name,
       service
     );
 
-    gchar* safe_url = g_regex_replace_eval(
-      entities, record->event->url, -1, /* regex, string, strlen */
-      0, 0,                             /* start position, flags */
-      entity_replace_callback, NULL, &error
-    );
-    if (!safe_url || error) {
-      g_print("failed to regex-replacify URL '%s': %s",
-              record->event->url, error->message);
-      exit(1);
-    }
-
-    fprintf(
-      jtl,
-      "  <sample sc=\"1\" ts=\"%ld\" t=\"%f\" lt=\"%f\" ec=\"%d\" s=\"%s\" "
-      "by=\"%ld\" lb=\"%s\" />\n",
-      record->start / 1000,                             /* timestamp, milliseconds */
-      relative_time(record->start, record->finish),     /* elapsed time */
-      relative_time(record->start, record->first_data), /* latency */
-      record->successful ? 0 : 1,                       /* error count */
-      record->successful ? "true" : "false",            /* success */
-      record->bytes,                                    /* byte count */
-      safe_url                                          /* label */
-    );
-
-    g_free(safe_url);
+    /* the sample count is how many requests this one stands for, so JMeter
+     * tooling still estimates totals from a sampled trace */
+    writer_string(jtl, "  <sample sc=\"");
+    writer_uint(jtl, weights[i]);                           /* sample count */
+    writer_string(jtl, "\" ts=\"");
+    writer_uint(jtl, record->start / 1000);                 /* timestamp, milliseconds */
+    writer_string(jtl, "\" t=\"");
+    writer_seconds(jtl, record->start, record->finish);     /* elapsed time */
+    writer_string(jtl, "\" lt=\"");
+    writer_seconds(jtl, record->start, record->first_data); /* latency */
+    writer_string(jtl, "\" ec=\"");
+    writer_string(jtl, record->successful ? "0" : "1");     /* error count */
+    writer_string(jtl, "\" s=\"");
+    writer_string(jtl, record->successful ? "true" : "false"); /* success */
+    writer_string(jtl, "\" by=\"");
+    writer_uint(jtl, record->bytes);                        /* byte count */
+    writer_string(jtl, "\" lb=\"");
+    writer_string(jtl, label);                              /* label */
+    writer_string(jtl, "\" />\n");
   }
 
-  free_uri(uri);
+  g_free(weights);
 
   return FALSE;                 /* continue traversal */
 }
 
 static void write_network_data(Stats *stats) {
   WriteNetworkClosure closure = {
-    .csv = fopen("network.csv", "wb"),
-    /* hash string => FILE* */
+    .stats = stats,
+    .csv   = writer_new(stats_fopen(stats, "network.csv")),
+    /* hash string => Writer* */
     .jtl = g_hash_table_new_full(
       g_str_hash, g_str_equal, g_free, close_jtl_file
-    )
+    ),
+    .rand  = g_rand_new()
   };
-  fprintf(closure.csv, "scenario, part, scheme, service, path, first_byte, total\n");
+  writer_string(closure.csv, "scenario, part, target, scheme, service, path, "
+                "first_byte, total, phase, weight\n");
   g_tree_foreach(stats->by_url, write_network_url_entry, &closure);
-  fclose(closure.csv);
+  writer_close(closure.csv);
+  g_rand_free(closure.rand);
+
+  stats->trace_kept  = closure.kept;
+  stats->trace_total = closure.total;
   /* this will close all files, free the keys, and destroy the object */
   g_hash_table_unref(closure.jtl);
 }
 
+typedef struct WriteScenarioClosure {
+  Stats*  stats;
+  FILE*   out;
+  Writer* writer;
+} WriteScenarioClosure;
 
 static gboolean write_scenario_part_data(
   gpointer key_, gpointer value_, gpointer data_
 ) {
-  ScenarioPart* part    = key_;
-  GPtrArray*    samples = value_;
-  FILE*         out     = data_;
+  ScenarioPart*         part    = key_;
+  GPtrArray*            samples = value_;
+  WriteScenarioClosure* closure = data_;
+  Writer*               out     = closure->writer;
 
   for (int i = 0; i < samples->len; ++i) {
     EventFinished* record = samples->pdata[i];
+    /* scenario, part, target, first_byte, total, phase */
+    writer_string(out, part->scenario->name);
+    writer_string(out, ", ");
+    writer_string(out, part->name);
+    writer_string(out, ", ");
+    writer_string(out, target_name(closure->stats, record->target));
+    writer_string(out, ", ");
+    writer_seconds(out, record->start, record->first_data);
+    writer_string(out, ", ");
+    writer_seconds(out, record->start, record->finish);
+    writer_string(out, ", ");
+    writer_string(out, phase_names[sample_phase(closure->stats, record)]);
+    writer_string(out, "\n");
+  }
+
+  return FALSE;                 /* continue traversal */
+}
+
+static void write_scenario_data(Stats *stats) {
+  WriteScenarioClosure closure = {
+    .stats  = stats,
+    .writer = writer_new(stats_fopen(stats, "scenario.csv"))
+  };
+  writer_string(closure.writer, "scenario, part, target, first_byte, total, phase\n");
+  g_tree_foreach(stats->by_scenario_part, write_scenario_part_data, &closure);
+  writer_close(closure.writer);
+}
+
+
+static void write_summary_target(
+  WriteScenarioClosure* closure, ScenarioPart* part, GPtrArray* samples,
+  guint target
+) {
+  GArray* totals   = g_array_sized_new(FALSE, FALSE, sizeof(gdouble), samples->len);
+  guint   seen     = 0;
+  guint   excluded = 0;
+  guint   errors   = 0;
+  gdouble sum      = 0;
+
+  for (int i = 0; i < samples->len; ++i) {
+    EventFinished* record = samples->pdata[i];
+    if (record->target != target)
+      continue;
+
+    seen += 1;
+    if (sample_phase(closure->stats, record) != PHASE_MEASURED) {
+      excluded += 1;
+      continue;
+    }
+
+    gdouble total = relative_time(record->start, record->finish);
+    g_array_append_val(totals, total);
+    sum += total;
+    if (!record->successful)
+      errors += 1;
+  }
+
+  g_array_sort(totals, compare_double);
+
+  /* a target that a part never reached has nothing to say */
+  if (seen > 0) {
     fprintf(
-      out, "%s, %s, %f, %f\n",
-      part->scenario->name, part->name,
-      relative_time(record->start, record->first_data),
-      relative_time(record->start, record->finish)
+      closure->out, "%s, %s, %s, %d, %d, %d, %f, %f, %f, %f, %f, %f\n",
+      part->scenario->name, part->name, target_name(closure->stats, target),
+      totals->len, excluded, errors,
+      totals->len ? sum / totals->len : 0,
+      percentile(totals, 50), percentile(totals, 90),
+      percentile(totals, 95), percentile(totals, 99),
+      percentile(totals, 100)
     );
   }
 
+  g_array_free(totals, TRUE);
+}
+
+static gboolean write_summary_part_data(
+  gpointer key_, gpointer value_, gpointer data_
+) {
+  ScenarioPart*         part    = key_;
+  GPtrArray*            samples = value_;
+  WriteScenarioClosure* closure = data_;
+
+  for (guint t = 0; t < closure->stats->suite->targets->len; ++t)
+    write_summary_target(closure, part, samples, t);
+
   return FALSE;                 /* continue traversal */
 }
 
-static void write_scenario_data(Stats *stats) {
-  FILE* c = fopen("scenario.csv", "wb");
-  fprintf(c, "scenario, part, first_byte, total\n");
-  g_tree_foreach(stats->by_scenario_part, write_scenario_part_data, c);
+static void write_summary_data(Stats *stats) {
+  WriteScenarioClosure closure = {
+    .stats = stats,
+    .out   = stats_fopen(stats, "summary.csv")
+  };
+  fprintf(closure.out, "scenario, part, target, samples, excluded, errors, "
+          "mean, p50, p90, p95, p99, max\n");
+  g_tree_foreach(stats->by_scenario_part, write_summary_part_data, &closure);
+  fclose(closure.out);
+}
+
+
+static void write_csv_string(FILE* out, const char* text) {
+  fputc('"', out);
+  for (const char* c = text; *c; ++c) {
+    if (*c == '"')
+      fputc('"', out);
+    fputc(*c, out);
+  }
+  fputc('"', out);
+}
+
+static gint compare_marker(gconstpointer a, gconstpointer b) {
+  const Marker* x = *(Marker* const*)a;
+  const Marker* y = *(Marker* const*)b;
+  return x->when < y->when ? -1 : (x->when > y->when ? 1 : 0);
+}
+
+/* 1-2-5 series histogram buckets, in seconds, enough to cover max */
+static GArray* histogram_bounds(gdouble max) {
+  static const gdouble steps[] = { 1, 2, 5 };
+  GArray* bounds = g_array_new(FALSE, FALSE, sizeof(gdouble));
+
+  for (gdouble decade = 0.1; ; decade *= 10) {
+    for (guint i = 0; i < G_N_ELEMENTS(steps); ++i) {
+      gdouble bound = decade * steps[i];
+      g_array_append_val(bounds, bound);
+      if (bound >= max)
+        return bounds;
+    }
+  }
+}
+
+typedef struct WriteProvisioningClosure {
+  Stats* stats;
+  FILE*  summary;
+  FILE*  phases;
+  FILE*  histogram;
+  FILE*  lifecycle;
+} WriteProvisioningClosure;
+
+static void write_duration_summary(FILE* out, GArray* sorted) {
+  gdouble sum = 0;
+  for (guint i = 0; i < sorted->len; ++i)
+    sum += g_array_index(sorted, gdouble, i);
+
+  fprintf(
+    out, "%f, %f, %f, %f, %f, %f\n",
+    sorted->len ? sum / sorted->len : 0,
+    percentile(sorted, 50), percentile(sorted, 90),
+    percentile(sorted, 95), percentile(sorted, 99),
+    percentile(sorted, 100)
+  );
+}
+
+/* the summaries of the nodes of a scenario that stuck to one target, or to
+ * none (-1), unless there were none of them */
+static void write_provisioning_target(
+  WriteProvisioningClosure* closure, const char* name, GPtrArray* records,
+  gint target
+) {
+  const char* label    = target < 0 ? "any" : target_name(closure->stats, target);
+
+  /* time to provisioned, and the duration of each phase of the final pass */
+  GArray*     totals   = g_array_new(FALSE, FALSE, sizeof(gdouble));
+  GPtrArray*  phases   = g_ptr_array_new();
+  GPtrArray*  names    = g_ptr_array_new();
+  guint       seen     = 0;
+  guint       failed   = 0;
+  guint       excluded = 0;
+  guint       reboots  = 0;
+
+  for (guint i = 0; i < records->len; ++i) {
+    ScenarioFinished* record = g_ptr_array_index(records, i);
+    if (record->target != target)
+      continue;
+
+    seen += 1;
+    if (lifecycle_phase(closure->stats, record) != PHASE_MEASURED) {
+      excluded += 1;
+      continue;
+    }
+
+    reboots += record->reboots;
+    if (!record->provisioned) {
+      failed += 1;
+      continue;
+    }
+
+    guint64 end   = record->part_ends->len
+      ? g_array_index(record->part_ends, guint64, record->part_ends->len - 1)
+      : record->restart;
+    gdouble total = relative_time(record->start, end);
+    g_array_append_val(totals, total);
+
+    GList*  part = record->scenario->parts;
+    guint64 from = record->restart;
+    for (guint j = 0; j < record->part_ends->len; ++j, part = part->next) {
+      guint64 to = g_array_index(record->part_ends, guint64, j);
+      if (j >= phases->len) {
+        g_ptr_array_add(phases, g_array_new(FALSE, FALSE, sizeof(gdouble)));
+        g_ptr_array_add(names, (gpointer)((ScenarioPart*)part->data)->name);
+      }
+
+      gdouble duration = relative_time(from, to);
+      g_array_append_val(g_ptr_array_index(phases, j), duration);
+      from = to;
+    }
+  }
+
+  /* a target that no node of the scenario stuck to has nothing to say */
+  if (seen > 0) {
+    g_array_sort(totals, compare_double);
+    fprintf(
+      closure->summary, "%s, %s, %d, %d, %d, %d, ",
+      name, label, totals->len, failed, excluded, reboots
+    );
+    write_duration_summary(closure->summary, totals);
+  }
+
+  for (guint j = 0; j < phases->len; ++j) {
+    GArray* durations = g_ptr_array_index(phases, j);
+    g_array_sort(durations, compare_double);
+    fprintf(
+      closure->phases, "%s, %s, %d, %s, %d, ",
+      name, label, j, (const char*)g_ptr_array_index(names, j), durations->len
+    );
+    write_duration_summary(closure->phases, durations);
+    g_array_free(durations, TRUE);
+  }
+
+  if (totals->len > 0) {
+    GArray* bounds = histogram_bounds(percentile(totals, 100));
+    guint   index  = 0;
+    for (guint j = 0; j < bounds->len; ++j) {
+      gdouble bound = g_array_index(bounds, gdouble, j);
+      guint   count = 0;
+      while (index < totals->len && g_array_index(totals, gdouble, index) <= bound) {
+        count += 1;
+        index += 1;
+      }
+      fprintf(closure->histogram, "%s, %s, %g, %d\n", name, label, bound, count);
+    }
+    g_array_free(bounds, TRUE);
+  }
+
+  g_ptr_array_free(phases, TRUE);
+  g_ptr_array_free(names, TRUE);
+  g_array_free(totals, TRUE);
+}
+
+static gboolean write_provisioning_entry(
+  gpointer key_, gpointer value_, gpointer data_
+) {
+  const char*               name    = key_;
+  GPtrArray*                records = value_;
+  WriteProvisioningClosure* closure = data_;
+
+  /* the raw spans keep everything, whatever the measurement window */
+  for (guint i = 0; i < records->len; ++i) {
+    ScenarioFinished* record = g_ptr_array_index(records, i);
+    SamplePhase       phase  = lifecycle_phase(closure->stats, record);
+
+    GList*  part = record->scenario->parts;
+    guint64 from = record->restart;
+    for (guint j = 0; j < record->part_ends->len; ++j, part = part->next) {
+      guint64 to = g_array_index(record->part_ends, guint64, j);
+      fprintf(
+        closure->lifecycle, "%s, %d, %s, %s, %f, %f, %f, %d, %s, %s\n",
+        name, record->node,
+        record->target < 0 ? "any" : target_name(closure->stats, record->target),
+        ((ScenarioPart*)part->data)->name,
+        relative_time(closure->stats->suite->start_time, record->start),
+        relative_time(closure->stats->suite->start_time, from),
+        relative_time(closure->stats->suite->start_time, to),
+        record->reboots, record->provisioned ? "true" : "false",
+        phase_names[phase]
+      );
+      from = to;
+    }
+  }
+
+  /* with the sticky policy, each node's whole lifecycle ran against one
+   * target, so the summaries are split by target; otherwise every request
+   * picked its own, and the nodes are summarised together as "any" */
+  for (gint t = -1; t < (gint)closure->stats->suite->targets->len; ++t)
+    write_provisioning_target(closure, name, records, t);
+
+  return FALSE;                 /* continue traversal */
+}
+
+static void write_provisioning_data(Stats *stats) {
+  WriteProvisioningClosure closure = {
+    .stats     = stats,
+    .summary   = stats_fopen(stats, "provisioning.csv"),
+    .phases    = stats_fopen(stats, "phases.csv"),
+    .histogram = stats_fopen(stats, "provisioning-histogram.csv"),
+    .lifecycle = stats_fopen(stats, "lifecycle.csv")
+  };
+
+  fprintf(closure.summary, "scenario, target, provisioned, failed, excluded, "
+          "reboots, mean, p50, p90, p95, p99, max\n");
+  fprintf(closure.phases, "scenario, target, index, part, nodes, "
+          "mean, p50, p90, p95, p99, max\n");
+  fprintf(closure.histogram, "scenario, target, upper_bound, nodes\n");
+  fprintf(closure.lifecycle, "scenario, node, target, part, node_start, part_start, "
+          "part_end, reboots, provisioned, phase\n");
+
+  g_tree_foreach(stats->by_lifecycle, write_provisioning_entry, &closure);
+
+  fclose(closure.summary);
+  fclose(closure.phases);
+  fclose(closure.histogram);
+  fclose(closure.lifecycle);
+}
+
+
+/* attempts per logical request; retries of requests from an earlier interval
+ * can push this up with no logical requests at all, so report attempts */
+static gdouble amplification(guint attempts, guint logical) {
+  return logical ? (gdouble)attempts / logical : attempts;
+}
+
+static void write_retries(Stats *stats) {
+  FILE* c = stats_fopen(stats, "retries.csv");
+  fprintf(c, "service, target, logical, attempts, retries, reboot_attempts, "
+          "timeouts, errors, amplification\n");
+  for (Service service = 0; service < SERVICE_COUNT; ++service) {
+    for (guint target = 0; target < stats->suite->targets->len; ++target) {
+      ServiceTotals* totals = stats_service_totals(stats, target, service);
+      if (totals->attempts == 0)
+        continue;
+
+      fprintf(
+        c, "%s, %s, %d, %d, %d, %d, %d, %d, %f\n",
+        service_names[service], target_name(stats, target),
+        totals->logical, totals->attempts,
+        totals->retries, totals->reboot_attempts, totals->timeouts,
+        totals->errors, amplification(totals->attempts, totals->logical)
+      );
+    }
+  }
+  fclose(c);
+}
+
+static void write_sources(Stats *stats) {
+  GPtrArray* sources = stats->suite->sources;
+
+  FILE* c = stats_fopen(stats, "sources.csv");
+  fprintf(c, "source, attempts, connect_failures, sockets_opened, bind_failures, "
+          "peak_sockets, peak_time_wait, peak_port_pressure\n");
+  for (guint i = 0; i < MAX(sources->len, 1); ++i) {
+    SourceTotals* totals = &stats->sources[i];
+    Source*       source = sources->len ? g_ptr_array_index(sources, i) : NULL;
+
+    fprintf(
+      c, "%s, %d, %d, %d, %d, %d, %d, %f\n",
+      source ? source->name : "default",
+      totals->attempts, totals->connect_failures,
+      source ? g_atomic_int_get(&source->sockets) : 0,
+      source ? g_atomic_int_get(&source->bind_failures) : 0,
+      totals->peak_sockets, totals->peak_time_wait,
+      (gdouble)totals->peak_busiest / sources_port_range()
+    );
+  }
   fclose(c);
 }
 
+static void write_timeseries(Stats *stats) {
+  guint64     start   = stats->suite->start_time;
+  const guint targets = stats->suite->targets->len;
+
+  g_ptr_array_sort(stats->markers, compare_marker);
+
+  FILE* c = stats_fopen(stats, "timeseries.csv");
+  fprintf(c, "when, requests, errors, bytes, mean_total, provisioned, "
+          "provisioned_per_minute, heartbeats, heartbeat_errors, "
+          "heartbeat_mean_total, logical, amplification");
+  for (Service service = 0; service < SERVICE_COUNT; ++service)
+    fprintf(c, ", %s_amplification", service_names[service]);
+  fprintf(c, ", connect_failures, sockets, time_wait, port_pressure");
+  for (guint t = 0; t < targets; ++t) {
+    const char* name = target_name(stats, t);
+    fprintf(c, ", %s_requests, %s_errors, %s_mean_total", name, name, name);
+  }
+  fprintf(c, ", marker\n");
+
+  guint marker     = 0;
+  guint per_minute = 0;         /* provisioned over the trailing 60 seconds */
+  for (guint i = 0; i < stats->intervals->len; ++i) {
+    Interval* interval = &g_array_index(stats->intervals, Interval, i);
+    guint     logical  = 0;
+    for (Service service = 0; service < SERVICE_COUNT; ++service)
+      logical += interval->logical[service];
+
+    per_minute += interval->provisioned;
+    if (i >= 60)
+      per_minute -= g_array_index(stats->intervals, Interval, i - 60).provisioned;
+
+    fprintf(
+      c, "%d, %d, %d, %" G_GUINT64_FORMAT ", %f, %d, %d, %d, %d, %f, %d, %f, ",
+      i, interval->requests, interval->errors, interval->bytes,
+      interval->requests ? interval->latency / interval->requests : 0,
+      interval->provisioned, per_minute,
+      interval->heartbeats, interval->heartbeat_errors,
+      interval->heartbeats ? interval->heartbeat_latency / interval->heartbeats : 0,
+      logical, amplification(interval->requests, logical)
+    );
+
+    for (Service service = 0; service < SERVICE_COUNT; ++service)
+      fprintf(c, "%f, ", amplification(interval->attempts[service],
+                                       interval->logical[service]));
+
+    fprintf(c, "%d, %d, %d, %f, ", interval->connect_failures,
+            interval->sockets, interval->time_wait, interval->port_pressure);
+
+    for (guint t = 0; t < targets; ++t) {
+      TargetInterval  none = { 0 };
+      TargetInterval* ti   = interval->targets ? &interval->targets[t] : &none;
+      fprintf(c, "%d, %d, %f, ", ti->requests, ti->errors,
+              ti->requests ? ti->latency / ti->requests : 0);
+    }
+
+    /* every marker recorded during this interval, in time order */
+    GString* text = g_string_new("");
+    for (; marker < stats->markers->len; ++marker) {
+      Marker* m = g_ptr_array_index(stats->markers, marker);
+      if (relative_time(start, m->when) >= i + 1)
+        break;
+      g_string_append_printf(text, "%s%s", text->len ? "; " : "", m->text);
+    }
+    write_csv_string(c, text->str);
+    g_string_free(text, TRUE);
+    fputc('\n', c);
+  }
+  fclose(c);
+
+  c = stats_fopen(stats, "markers.csv");
+  fprintf(c, "when, marker\n");
+  for (guint i = 0; i < stats->markers->len; ++i) {
+    Marker* m = g_ptr_array_index(stats->markers, i);
+    fprintf(c, "%f, ", relative_time(start, m->when));
+    write_csv_string(c, m->text);
+    fputc('\n', c);
+  }
+  fclose(c);
+}
+
+
+/* a window of intervals is steady if both throughput and mean latency have
+ * a coefficient of variation within our tolerance. */
+static gboolean interval_window_is_steady(
+  Stats* stats, guint first, guint window, gdouble tolerance
+) {
+  gdouble rate_sum = 0, rate_sq = 0, latency_sum = 0, latency_sq = 0;
+
+  for (guint i = first; i < first + window; ++i) {
+    Interval* interval = &g_array_index(stats->intervals, Interval, i);
+    if (interval->requests == 0)
+      return FALSE;             /* nothing happening is not steady */
+
+    gdouble latency = interval->latency / interval->requests;
+    rate_sum    += interval->requests;
+    rate_sq     += (gdouble)interval->requests * interval->requests;
+    latency_sum += latency;
+    latency_sq  += latency * latency;
+  }
+
+  gdouble rate_mean    = rate_sum / window;
+  gdouble latency_mean = latency_sum / window;
+  gdouble rate_sd      = sqrt(MAX(rate_sq / window - rate_mean * rate_mean, 0));
+  gdouble latency_sd   =
+    sqrt(MAX(latency_sq / window - latency_mean * latency_mean, 0));
+
+  return rate_sd / rate_mean <= tolerance &&
+    (latency_mean == 0 || latency_sd / latency_mean <= tolerance);
+}
+
+static void stats_detect_steady_state(Stats* stats) {
+  TestSuite* suite  = stats->suite;
+  guint      window = suite->steady_window;
+  gint       first  = -1;
+  gint       last   = -1;
+
+  for (guint i = suite->warmup_seconds; i + window <= stats->intervals->len; ++i) {
+    if (interval_window_is_steady(stats, i, window, suite->steady_tolerance)) {
+      if (first < 0)
+        first = i;
+      last = i + window;
+    }
+  }
+
+  if (first < 0) {
+    g_print("No steady state detected; summarising everything after warm-up\n");
+    return;
+  }
+
+  stats->steady_start = suite->start_time + (guint64)first * 1000000;
+  stats->steady_end   = suite->start_time + (guint64)last  * 1000000;
+  g_print("Steady state detected from %d to %d seconds\n", first, last);
+
+  Marker* start = g_slice_new(Marker);
+  start->when   = stats->steady_start;
+  start->text   = g_strdup("steady state start");
+  stats_record_marker(stats, start);
+
+  Marker* end = g_slice_new(Marker);
+  end->when   = stats->steady_end;
+  end->text   = g_strdup("steady state end");
+  stats_record_marker(stats, end);
+}
+
+
+/** one report, written alongside the others */
+typedef struct Report {
+  const char* files;
+  void        (*write)(Stats* stats);
+  Stats*      stats;
+  GThread*    thread;
+  gint64      elapsed;          /* microseconds */
+} Report;
+
+static gpointer report_thread(Report* report) {
+  gint64 start = g_get_monotonic_time();
+  report->write(report->stats);
+  report->elapsed = g_get_monotonic_time() - start;
+  return NULL;
+}
 
 void stats_print_report(Stats* stats) {
+  /* let a scan in progress report, then refuse anything sent from now on,
+   * and wait for everything still queued for recording to land */
+  g_thread_pool_free(stats->sampler, FALSE, TRUE);
+  stats->sampler = NULL;
+
+  g_mutex_lock(&stats->lock);
+  GThreadPool* pool = stats->pool;
+  stats->pool       = NULL;
+  g_mutex_unlock(&stats->lock);
+  g_thread_pool_free(pool, FALSE, TRUE);
+
+  if (stats->suite->warmup_seconds) {
+    Marker* marker = g_slice_new(Marker);
+    marker->when   = stats->suite->start_time +
+      (guint64)stats->suite->warmup_seconds * 1000000;
+    marker->text   = g_strdup("warm-up period complete");
+    stats_record_marker(stats, marker);
+  }
+
+  if (stats->suite->steady_state)
+    stats_detect_steady_state(stats);
+
+  /* the reports only read what has been recorded, so each is written on
+   * a thread of its own; the longest, network.csv, sets the pace */
+  Report reports[] = {
+    { "concurrency.csv", write_concurrency },
+    { "timeseries.csv, markers.csv", write_timeseries },
+    { "provisioning.csv, phases.csv, provisioning-histogram.csv, lifecycle.csv",
+      write_provisioning_data },
+    { "retries.csv", write_retries },
+    { "sources.csv", write_sources },
+    { "network.csv, network-*.jtl", write_network_data },
+    { "scenario.csv", write_scenario_data },
+    { "summary.csv", write_summary_data }
+  };
+
   g_print("Writing stats reports:\n");
 
-  /* concurrency data */
-  g_print(" - concurrency.csv: ");
-  write_concurrency(stats);
-  g_print("done\n");
+  gint64 start = g_get_monotonic_time();
+  for (guint i = 0; i < G_N_ELEMENTS(reports); ++i) {
+    reports[i].stats  = stats;
+    reports[i].thread = g_thread_new("report", (GThreadFunc)report_thread, &reports[i]);
+  }
+
+  for (guint i = 0; i < G_N_ELEMENTS(reports); ++i) {
+    g_thread_join(reports[i].thread);
+    g_print(" - %s: done in %.2f seconds\n", reports[i].files,
+            reports[i].elapsed / 1000000.0);
+  }
 
-  g_print(" - network.csv, network-*.jtl: ");
-  write_network_data(stats);
-  g_print("done\n");
+  if (stats->trace_kept < stats->trace_total)
+    g_print("Kept %d of %d samples in network.csv and the JTL files\n",
+            stats->trace_kept, stats->trace_total);
+  g_print("Wrote stats reports in %.2f seconds\n",
+          (g_get_monotonic_time() - start) / 1000000.0);
+}
 
-  g_print(" - scenario.csv: ");
-  write_scenario_data(stats);
-  g_print("done\n");
+static void add_benchmark_parts(GPtrArray* parts, const Scenario* scenario) {
+  for (GList* part = scenario->parts; part; part = part->next)
+    if (((ScenarioPart*)part->data)->events->len > 0)
+      g_ptr_array_add(parts, part->data);
+}
+
+void stats_benchmark_report(Stats* stats, guint samples) {
+  TestSuite* suite = stats->suite;
+  GPtrArray* parts = g_ptr_array_new();
+
+  for (guint i = 0; i < suite->scenarios->len; ++i)
+    add_benchmark_parts(parts, g_ptr_array_index(suite->scenarios, i));
+  for (guint i = 0; i < suite->replay->len; ++i)
+    add_benchmark_parts(parts, g_ptr_array_index(suite->replay, i));
+
+  if (parts->len == 0) {
+    g_critical("there are no events to make up samples for");
+    exit(1);
+  }
+
+  /* a thousand requests a second, finishing now, with one in a hundred
+   * failing; the reports care about how many there are, not their values */
+  GRand*  rand = g_rand_new_with_seed(samples);
+  guint64 span = ((guint64)samples / 1000 + 1) * 1000000;
+  suite->end_time   = g_get_monotonic_time();
+  suite->start_time = suite->end_time - span;
+
+  for (guint i = 0; i < samples; ++i) {
+    ScenarioPart*  part   = g_ptr_array_index(parts, i % parts->len);
+    Event*         event  = g_ptr_array_index(
+      part->events, g_rand_int_range(rand, 0, part->events->len)
+    );
+    EventFinished* record = stats_event_finished_new(event, part);
+
+    record->start      = suite->start_time + span * i / samples;
+    record->first_data = record->start + g_rand_int_range(rand, 1000, 50000);
+    record->finish     = record->first_data + g_rand_int_range(rand, 0, 500000);
+    record->successful = g_rand_int_range(rand, 0, 100) != 0;
+    record->bytes      = g_rand_int_range(rand, 100, 100000);
+    record->attempt    = 1;
+    record->target     = i % suite->targets->len;
+    stats_event_finished(stats, record);
+  }
+
+  g_print("Benchmarking reports on %d made up requests to %d part%s\n",
+          samples, parts->len, parts->len == 1 ? "" : "s");
+  stats_print_report(stats);
+
+  g_rand_free(rand);
+  g_ptr_array_free(parts, TRUE);
 }
 
 
 /**************************************************************************
  * Private helpers
  */
-static gint compare_pointer(gconstpointer a, gconstpointer b) {
-  return GPOINTER_TO_INT(a) - GPOINTER_TO_INT(b);
+/* samples are grouped by name, so that parts and scenarios made for each
+ * node - as a replay does - report together */
+static gint compare_scenario_name(gconstpointer a, gconstpointer b) {
+  return g_strcmp0(((const Scenario*)a)->name, ((const Scenario*)b)->name);
+}
+
+static gint compare_part_name(gconstpointer a, gconstpointer b) {
+  const ScenarioPart* x = a;
+  const ScenarioPart* y = b;
+  gint                c = compare_scenario_name(x->scenario, y->scenario);
+  return c ? c : g_strcmp0(x->name, y->name);
 }
 
 static void stats_send_event(
-  GThreadPool* pool, StatsEventFunc handler, gpointer data
+  Stats* stats, StatsEventFunc handler, GDestroyNotify destroy, gpointer data
 ) {
+  g_mutex_lock(&stats->lock);
+
+  /* reporting has started, so anything arriving now is too late to count */
+  if (!stats->pool) {
+    g_mutex_unlock(&stats->lock);
+    if (destroy && data)
+      destroy(data);
+    return;
+  }
+
   StatsEvent* event = g_slice_new(StatsEvent);
   event->handler    = handler;
   event->data       = data;
-  g_thread_pool_push(pool, event, NULL);
+  g_thread_pool_push(stats->pool, event, NULL);
+  g_mutex_unlock(&stats->lock);
+}
+
+static void event_finished_free(EventFinished* data) {
+  g_slice_free(EventFinished, data);
+}
+
+static void scenario_finished_free(ScenarioFinished* data) {
+  g_array_free(data->part_ends, TRUE);
+  g_slice_free(ScenarioFinished, data);
+}
+
+static void socket_sample_free(gpointer data) {
+  SocketSample* sample = data;
+  g_free(sample->in_use);
+  g_free(sample->time_wait);
+  g_free(sample->busiest);
+  g_slice_free(SocketSample, sample);
+}
+
+static void concurrency_free(gpointer data) {
+  ConcurrencyClosure* closure = data;
+  g_free(closure->outstanding);
+  g_slice_free(ConcurrencyClosure, closure);
+}
+
+static void marker_free(gpointer data) {
+  Marker* marker = data;
+  g_free(marker->text);
+  g_slice_free(Marker, marker);
 }
 
 static void stats_handler(StatsEvent* event, Stats* stats) {
@@ -364,10 +1295,133 @@ static void add_event_finished_record(GTree* tree, gpointer key, EventFinished*
   g_ptr_array_add(array, data);
 }
 
+static Interval* stats_interval(Stats* stats, guint64 when) {
+  guint64 start = stats->suite->start_time;
+  guint   index = when > start ? (when - start) / 1000000 : 0;
+
+  if (index >= stats->intervals->len)
+    g_array_set_size(stats->intervals, index + 1);
+
+  return &g_array_index(stats->intervals, Interval, index);
+}
+
+static SamplePhase phase_at(Stats* stats, gboolean warmup, guint64 when) {
+  if (warmup)
+    return PHASE_WARMUP;
+
+  if (stats->steady_start && when < stats->steady_start)
+    return PHASE_WARMUP;
+
+  if (stats->steady_end && when >= stats->steady_end)
+    return PHASE_COOLDOWN;
+
+  return PHASE_MEASURED;
+}
+
+static SamplePhase sample_phase(Stats* stats, const EventFinished* record) {
+  return phase_at(stats, record->warmup, record->finish);
+}
+
+/* a node lifecycle runs for minutes, so it counts from when it started */
+static SamplePhase lifecycle_phase(Stats* stats, const ScenarioFinished* record) {
+  return phase_at(stats, record->warmup, record->start);
+}
+
+/* add a request to the running totals, returning the interval it fell in */
+static Interval* stats_count_event(Stats* stats, EventFinished* data) {
+  TestSuite* suite = stats->suite;
+
+  /* the warm-up ends once *both* the time and request count are passed */
+  data->warmup = stats->finished < suite->warmup_requests ||
+    data->start < suite->start_time + (guint64)suite->warmup_seconds * 1000000;
+  stats->finished += 1;
+
+  if (stats->finished == suite->warmup_requests) {
+    Marker* marker = g_slice_new(Marker);
+    marker->when   = data->finish;
+    marker->text   = g_strdup("warm-up requests complete");
+    stats_record_marker(stats, marker);
+  }
+
+  Interval* interval = stats_interval(stats, data->finish);
+  interval->requests += 1;
+  interval->errors   += data->successful ? 0 : 1;
+  interval->bytes    += data->bytes;
+  interval->latency  += relative_time(data->start, data->finish);
+
+  if (!interval->targets)
+    interval->targets = g_new0(TargetInterval, suite->targets->len);
+  TargetInterval* target = &interval->targets[data->target];
+  target->requests += 1;
+  target->errors   += data->successful ? 0 : 1;
+  target->latency  += relative_time(data->start, data->finish);
+
+  /* a logical request is the first attempt by a node that has not had to
+   * reboot; everything else is load amplified by retries */
+  const Service  service = data->event->service;
+  const gboolean logical = data->attempt == 1 && data->reboot == 0;
+  ServiceTotals* totals  = stats_service_totals(stats, data->target, service);
+
+  interval->attempts[service] += 1;
+  interval->logical[service]  += logical ? 1 : 0;
+  interval->connect_failures  += data->connect_failed ? 1 : 0;
+
+  /* with no pool, everything comes from the one default source */
+  if (data->source >= 0 || suite->sources->len == 0) {
+    SourceTotals* source = &stats->sources[MAX(data->source, 0)];
+    source->attempts         += 1;
+    source->connect_failures += data->connect_failed ? 1 : 0;
+  }
+
+  totals->attempts        += 1;
+  totals->logical         += logical ? 1 : 0;
+  totals->retries         += data->attempt > 1 ? 1 : 0;
+  totals->reboot_attempts += data->reboot > 0 ? 1 : 0;
+  totals->timeouts        += data->timed_out ? 1 : 0;
+  totals->errors          += data->successful ? 0 : 1;
+
+  return interval;
+}
+
 static void stats_record_event_finished(Stats* stats, EventFinished* data) {
-  add_event_finished_record(stats->by_url, (gpointer)data->event->url, data);
-  add_event_finished_record(stats->by_scenario, data->event->scenario_part->scenario, data);
-  add_event_finished_record(stats->by_scenario_part, data->event->scenario_part, data);
+  stats_count_event(stats, data);
+
+  /* each target has its own URL, so samples are split by target here */
+  add_event_finished_record(
+    stats->by_url, (gpointer)data->event->urls[data->target], data
+  );
+  add_event_finished_record(stats->by_scenario, (gpointer)data->part->scenario, data);
+  add_event_finished_record(stats->by_scenario_part, (gpointer)data->part, data);
+}
+
+/* background load, counted apart so that it does not move the request
+ * series, the warm-up count or the steady state detector */
+static void stats_record_heartbeat_finished(Stats* stats, EventFinished* data) {
+  Interval* interval = stats_interval(stats, data->finish);
+  interval->heartbeats        += 1;
+  interval->heartbeat_errors  += data->successful ? 0 : 1;
+  interval->heartbeat_latency += relative_time(data->start, data->finish);
+
+  event_finished_free(data);
+}
+
+static void stats_record_scenario_finished(Stats* stats, ScenarioFinished* data) {
+  TestSuite* suite = stats->suite;
+  data->warmup =
+    data->start < suite->start_time + (guint64)suite->warmup_seconds * 1000000;
+
+  if (data->provisioned && data->part_ends->len > 0) {
+    guint64 end = g_array_index(data->part_ends, guint64, data->part_ends->len - 1);
+    stats_interval(stats, end)->provisioned += 1;
+  }
+
+  GPtrArray* array = g_tree_lookup(stats->by_lifecycle, data->scenario->name);
+  if (!array) {
+    array = g_ptr_array_new();
+    g_tree_insert(stats->by_lifecycle, (gpointer)data->scenario->name, array);
+  }
+
+  g_ptr_array_add(array, data);
 }
 
 static void stats_record_concurrency(Stats* stats, gpointer raw) {
@@ -375,59 +1429,169 @@ static void stats_record_concurrency(Stats* stats, gpointer raw) {
   g_ptr_array_add(stats->concurrency, raw);
 }
 
+static void stats_record_marker(Stats* stats, gpointer raw) {
+  Marker* marker = raw;
+  g_ptr_array_add(stats->markers, marker);
 
-static gchar* dup_uri_range(UriTextRangeA range) {
-  if (!range.first || !range.afterLast || range.first == range.afterLast)
-    return NULL;
-  return g_strndup(range.first, range.afterLast - range.first);
+  /* make sure the timeseries extends far enough to show the marker */
+  stats_interval(stats, marker->when);
 }
 
-static URI* parse_uri(const char* text) {
-  UriUriA          uri;
-  UriParserStateA  uri_state = { .uri = &uri };
 
-  URI* result = NULL;
+/* runs in turn with recording, so the reports see a consistent run so far */
+static void stats_record_snapshot(Stats* stats, gpointer raw) {
+  gchar* dirname = raw;
 
-  if (uriParseUriA(&uri_state, text) != URI_SUCCESS) {
-    g_print("failed to parse URL %s\n", text);
-    goto out;
+  if (g_mkdir_with_parents(dirname, 0755) != 0) {
+    g_warning("can't create snapshot %s: %s", dirname, strerror(errno));
+    g_free(dirname);
+    return;
   }
 
-  result = g_new0(URI, 1);
-  result->scheme   = dup_uri_range(uri.scheme);
-  result->user     = dup_uri_range(uri.userInfo);
-  result->host     = dup_uri_range(uri.hostText);
-  /* port is hard */
-  /* path is hard */
-  result->query    = dup_uri_range(uri.query);
-  result->fragment = dup_uri_range(uri.fragment);
+  stats->output_dir = dirname;
+  write_timeseries(stats);
+  write_provisioning_data(stats);
+  write_retries(stats);
+  write_sources(stats);
+  write_summary_data(stats);
+  stats->output_dir = NULL;
+
+  g_free(dirname);
+}
 
-  /* ick, thanks uriparser, and const struct members */
-  const char* port = dup_uri_range(uri.portText);
-  if (port)
-    result->port = g_ascii_strtoll(port, NULL, 10);
-  g_free((gpointer)port);
+/* on the sampler thread, so that the recording thread only gets the counts */
+static void stats_sampler(gpointer data, Stats* stats) {
+  SocketSample* sample = data;
+  sample->when = g_get_monotonic_time();
+  sources_sample(stats->suite, sample->in_use, sample->time_wait, sample->busiest);
+  g_atomic_int_set(&stats->sampling, 0);
+
+  stats_send_event(stats, stats_record_sockets, socket_sample_free, sample);
+}
 
-  /* also here, ick! */
-  GString* path = g_string_new("");
-  for (UriPathSegmentA *e = uri.pathHead; e; e = e->next) {
-    g_string_append_c(path, '/');
-    g_string_append_len(path, e->text.first, e->text.afterLast - e->text.first);
+static void stats_record_sockets(Stats* stats, gpointer raw) {
+  SocketSample* sample    = raw;
+  TestSuite*    suite     = stats->suite;
+  const guint   count     = MAX(suite->sources->len, 1);
+  const guint*  in_use    = sample->in_use;
+  const guint*  time_wait = sample->time_wait;
+  const guint*  tuples    = sample->busiest;
+  Interval*     interval  = stats_interval(stats, sample->when);
+  guint         busiest   = 0;
+
+  interval->sockets   = 0;
+  interval->time_wait = 0;
+  for (guint i = 0; i < count; ++i) {
+    SourceTotals* source = &stats->sources[i];
+    source->peak_sockets   = MAX(source->peak_sockets, in_use[i]);
+    source->peak_time_wait = MAX(source->peak_time_wait, time_wait[i]);
+    source->peak_busiest   = MAX(source->peak_busiest, tuples[i]);
+
+    interval->sockets   += in_use[i];
+    interval->time_wait += time_wait[i];
+    if (tuples[i] > tuples[busiest])
+      busiest = i;
+  }
+  interval->port_pressure = (gdouble)tuples[busiest] / sources_port_range();
+
+  /* past this, connects start to stall waiting for a port, and the results
+   * say more about the generator than the server */
+  if (interval->port_pressure >= 0.8 && !stats->pressure_warned) {
+    const char* name = suite->sources->len
+      ? ((Source*)g_ptr_array_index(suite->sources, busiest))->name
+      : "the default source";
+
+    Marker* marker = g_slice_new(Marker);
+    marker->when   = sample->when;
+    marker->text   = g_strdup_printf(
+      "%s has %d of %d ephemeral ports in use to one target", name,
+      tuples[busiest], sources_port_range()
+    );
+    g_print("WARNING: %s; add source addresses with --source\n", marker->text);
+    stats_record_marker(stats, marker);
+    stats->pressure_warned = TRUE;
+  }
+
+  socket_sample_free(sample);
+}
+
+static FILE* stats_fopen(Stats* stats, const char* name) {
+  gchar* filename = stats->output_dir
+    ? g_build_filename(stats->output_dir, name, NULL)
+    : g_strdup(name);
+
+  FILE* result = fopen(filename, "wb");
+  if (!result) {
+    g_critical("can't open %s for output: %s", filename, strerror(errno));
+    exit(1);
   }
-  result->path = g_string_free(path, FALSE);
 
-out:
-  uriFreeUriMembersA(&uri);
+  g_free(filename);
   return result;
 }
 
-static void free_uri(URI* uri) {
-  g_free((gpointer)uri->scheme);
-  g_free((gpointer)uri->user);
-  g_free((gpointer)uri->host);
-  /* no need to free port */
-  g_free((gpointer)uri->path);
-  g_free((gpointer)uri->query);
-  g_free((gpointer)uri->fragment);
-  g_free(uri);
+
+
+static Writer* writer_new(FILE* file) {
+  Writer* writer = g_new0(Writer, 1);
+  writer->file   = file;
+  writer->buffer = g_string_sized_new(WRITER_BUFFER + 4096);
+  return writer;
+}
+
+static void writer_flush(Writer* writer) {
+  if (fwrite(writer->buffer->str, 1, writer->buffer->len, writer->file) !=
+      writer->buffer->len) {
+    g_critical("failed writing a report: %s", strerror(errno));
+    exit(1);
+  }
+  g_string_truncate(writer->buffer, 0);
+}
+
+static void writer_close(Writer* writer) {
+  writer_flush(writer);
+  fclose(writer->file);
+  g_string_free(writer->buffer, TRUE);
+  g_free(writer);
+}
+
+static void writer_string(Writer* writer, const char* text) {
+  g_string_append(writer->buffer, text);
+  if (writer->buffer->len >= WRITER_BUFFER)
+    writer_flush(writer);
+}
+
+static void writer_uint(Writer* writer, guint64 value) {
+  char  digits[24];
+  char* p = digits + sizeof(digits);
+
+  *--p = '\0';
+  do {
+    *--p   = '0' + value % 10;
+    value /= 10;
+  } while (value);
+
+  writer_string(writer, p);
+}
+
+/* a whole number of millionths, as "%f" would print it */
+static void writer_micro(Writer* writer, guint64 micro) {
+  char  digits[32];
+  char* p = digits + sizeof(digits);
+
+  *--p = '\0';
+  for (int i = 0; i < 6; ++i, micro /= 10)
+    *--p = '0' + micro % 10;
+  *--p = '.';
+  do {
+    *--p   = '0' + micro % 10;
+    micro /= 10;
+  } while (micro);
+
+  writer_string(writer, p);
+}
+
+/* the same as "%f" of relative_time(), which is exact to the microsecond */
+static void writer_seconds(Writer* writer, guint64 start, guint64 event) {
+  writer_micro(writer, event > start ? event - start : 0);
 }
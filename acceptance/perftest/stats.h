@@ -14,13 +14,31 @@ void stats_free();
 
 void stats_print_report(Stats* stats);
 
+/**
+ * Time writing the reports, on made up samples of every event in the
+ * scenarios loaded, rather than on a run.  The reports are written as
+ * stats_print_report() would, replacing any in the working directory.
+ * @param[in] stats    the stats object to report against, which must have
+ * nothing recorded yet.
+ * @param[in] samples  how many requests to make up.
+ */
+void stats_benchmark_report(Stats* stats, guint samples);
+
 typedef struct EventFinished {
-  const Event* event;
-  gboolean     successful;
-  guint64      bytes;
-  guint64      start;
-  guint64      first_data;
-  guint64      finish;
+  const Event*        event;
+  const ScenarioPart* part;     /* that ran the event */
+  gboolean            successful;
+  guint64             bytes;
+  guint64             start;
+  guint64             first_data;
+  guint64             finish;
+  guint               attempt;  /* one for the first try at a request */
+  guint               reboot;   /* times the node restarted the scenario */
+  guint               target;   /* index of the target it was made to */
+  gint                source;   /* index of the source address, or -1 */
+  gboolean            connect_failed;
+  gboolean            timed_out;
+  gboolean            warmup;   /* set by stats, not the reporter */
 } EventFinished;
 
 /**
@@ -36,15 +54,62 @@ void stats_event_finished(Stats* stats, EventFinished* data);
 
 /**
  * Allocate a new EventFinished structure.  The structure will be
- * zero-filled, other than the event pointer.
+ * zero-filled, other than the event and part pointers, and no source.
  *
  * @param[in] event  the Event that was completed.
+ * @param[in] part   the ScenarioPart that ran it; parts share events.
  * @returns[caller frees] the EventFinished message.
  */
-EventFinished* stats_event_finished_new(const Event* event);
+EventFinished* stats_event_finished_new(const Event* event, const ScenarioPart* part);
+
+/**
+ * Report a checkin from the idle population.  It is background load, so it
+ * is only added to heartbeat counters of its own: it takes no part in the
+ * request totals, warm-up, steady state or summaries.  The sample itself is
+ * not kept, so a large population checking in for a long run costs nothing
+ * more than a short one; checkins appear in the heartbeat columns of
+ * timeseries.csv, and nowhere else.
+ *
+ * @param[in] stats  the stats collection to report against.
+ * @param[in] data   from stats_event_finished_new(); freed once counted.
+ */
+void stats_heartbeat_finished(Stats* stats, EventFinished* data);
+
+typedef struct ScenarioFinished {
+  const Scenario* scenario;
+  guint           node;         /* numbered from zero as nodes start */
+  guint64         start;        /* when the node started the scenario */
+  guint64         restart;      /* when the final pass started, after reboots */
+  GArray*         part_ends;    /* guint64: when each part of that pass ended */
+  guint           reboots;
+  gboolean        provisioned;  /* no request ran out of attempts */
+  gint            target;       /* the node stuck to, or -1 for none */
+  gboolean        warmup;       /* set by stats, not the reporter */
+} ScenarioFinished;
+
+/**
+ * Report the lifecycle of a node that has finished running a scenario.
+ * @param[in] stats  the stats collection to report against.
+ * @param[in] data   a ScenarioFinished structure containing the data.
+ *
+ * the ScenarioFinished pointer must be allocated by the caller with
+ * stats_scenario_finished_new(), and the stats collection owns it after this
+ * call.
+ */
+void stats_scenario_finished(Stats* stats, ScenarioFinished* data);
 
 /**
- * Report a concurrency stats event.
+ * Allocate a new ScenarioFinished structure, with no parts finished, and
+ * no target.
+ *
+ * @param[in] scenario  the Scenario being run.
+ * @returns[caller frees] the ScenarioFinished message.
+ */
+ScenarioFinished* stats_scenario_finished_new(const Scenario* scenario);
+
+/**
+ * Report a concurrency stats event.  The requests in flight at each target
+ * are recorded along with it.
  * @param[in] stats    the stats object to report against
  * @param[in] pending  number of pending scenarios awaiting scheduling
  * @param[in] running  number of currently running scenarios
@@ -53,5 +118,32 @@ EventFinished* stats_event_finished_new(const Event* event);
  */
 void stats_report_concurrency(Stats* stats, guint pending, guint running, guint queued);
 
+/**
+ * Count the sockets each source address has open to the targets on
+ * ephemeral ports, and those in TIME_WAIT.  Called once a second; the scan
+ * of /proc/net/tcp runs on a thread of its own, since it is not cheap under
+ * port pressure, and only the counts go to the recording thread.  If the
+ * last scan has not finished, this one is skipped.
+ * @param[in] stats  the stats object to report against
+ */
+void stats_sample_sockets(Stats* stats);
+
+/**
+ * Record a marker in the timeseries, such as a change to the running load.
+ * The marker is timestamped when this is called.
+ * @param[in] stats  the stats object to report against
+ * @param[in] text   a short description of the marker; copied.
+ */
+void stats_report_marker(Stats* stats, const char* text);
+
+/**
+ * Write the timeseries, provisioning, retry and summary reports for the run
+ * so far, without stopping it.  The reports are written once everything
+ * reported before this call has been recorded.
+ * @param[in] stats    the stats object to report against
+ * @param[in] dirname  the directory to write into, created if need be; copied.
+ */
+void stats_snapshot(Stats* stats, const char* dirname);
+
 #endif /* STATS_H */
 
@@ -29,6 +29,10 @@ DEFAULT_MIN_CYCLE_TIME = 30
 # parameter value for the node_expire_timeout (uses a 15 minute default)
 DEFAULT_NODE_EXPIRE_TIMEOUT = 60 * 15
 
+# how often, in seconds, the superseded versions of objects are removed from
+# the database (every 15 minutes)
+HISTORY_COMPACT_INTERVAL = 60 * 15
+
 # monkey-patch the Daemons::Application class so that it uses a pattern of "*.log" for
 # the file that it uses to capture output from the Daemon (and the processes that it
 # manages) rather than the default pattern used by this class ("*.output")
@@ -179,6 +183,15 @@ class RazorDaemon < ProjectRazor::Object
     engine.remove_expired_nodes(node_expire_timeout)
   end
 
+  # used to remove the old versions of objects that each update leaves behind in
+  # the database; this is done here, in the long-running daemon, so the requests
+  # that read and write those objects never pay for it
+  def compact_history
+    engine = ProjectRazor::Engine.instance
+    removed = engine.compact_history
+    puts "Removed #{removed} superseded object versions" if removed > 0
+  end
+
   # used to shut down all "node-related" processes in the system during
   # the process of shutting down this daemon
   def shutdown_node_instances
@@ -312,6 +325,10 @@ Daemons.run_proc("razor_daemon", options) {
   # the event-handling loop, but not on the first pass (since we just loaded it)
   is_first_iteration = true
 
+  # when the object history was last compacted; nil until the first pass
+  # through the event-handling loop that finds the database up
+  last_history_compact = nil
+
   # now that everything is configured properly, enter the main event-handling loop
   loop do
 
@@ -349,6 +366,13 @@ Daemons.run_proc("razor_daemon", options) {
       # checked in during the past 'node_expire_timeout' seconds)
       razor_daemon.remove_expired_nodes(node_expire_timeout)
 
+      # remove superseded versions of objects from the database, every
+      # HISTORY_COMPACT_INTERVAL seconds
+      if !last_history_compact || t1 - last_history_compact >= HISTORY_COMPACT_INTERVAL
+        razor_daemon.compact_history
+        last_history_compact = t1
+      end
+
       # check to see how much time has elapsed, sleep for the time remaining
       # in the msecs_sleep time window
       t2 = Time.now
@@ -146,6 +146,14 @@ module ProjectRazor
       false
     end
 
+    # Removes the superseded versions of every {ProjectRazor::Object}, leaving only the latest
+    #
+    # @return [Integer] The number of versions removed
+    def compact_history
+      logger.debug "Compacting object history"
+      persist_ctrl.compact_history
+    end
+
 
 
 
@@ -382,6 +382,11 @@ module ProjectRazor
       system_tag_rules
     end
 
+    # removes the versions of objects superseded by a later update
+    def compact_history
+      get_data.compact_history
+    end
+
     # removes all nodes that have not checked in during the last
     # node_expire_timeout seconds from the database
     def remove_expired_nodes(node_expire_timeout)
@@ -1,4 +1,7 @@
 require "fileutils"
+require "find"
+require "etc"
+require "thread"
 require "digest/sha2"
 
 module ProjectRazor
@@ -9,6 +12,13 @@ module ProjectRazor
       MOUNT_COMMAND = (Process::uid == 0 ? "mount" : "sudo mount")
       UMOUNT_COMMAND = (Process::uid == 0 ? "umount" : "sudo umount")
 
+      # Files are copied by this many threads at once; beyond a handful the copy
+      # is limited by the disks rather than the cores
+      COPY_THREADS = [(Etc.respond_to?(:nprocessors) ? Etc.nprocessors : 4), 8].min
+
+      # Seconds between progress reports while copying an image
+      COPY_PROGRESS_INTERVAL = 5
+
       attr_accessor :filename
       attr_accessor :description
       attr_accessor :size
@@ -73,13 +83,14 @@ module ProjectRazor
             return cleanup([false, "Cannot create image path: #{image_path}"])
           end
 
-          # Attempt to copy from mount path to image path
-          copy_to_image_path
+          # Attempt to copy from mount path to image path; this walks the mount
+          # once, and returns the hash of its files as get_dir_hash would
+          mount_hash = copy_to_image_path
 
           # Verify diff between mount / image paths
           # For speed/flexibility reasons we just verify all files exists and not their contents
+          # (the copy has already checked that each file is the size of its original)
           @verification_hash = get_dir_hash(image_path)
-          mount_hash = get_dir_hash(mount_path)
           unless mount_hash == @verification_hash
             logger.error "Image copy failed verification: #{@verification_hash} <> #{mount_hash}"
             return cleanup([false, "Image copy failed verification: #{@verification_hash} <> #{mount_hash}"])
@@ -176,15 +187,107 @@ module ProjectRazor
         end
       end
 
+      # Copies the mounted image into the image path, and returns the hash of the
+      # copied files as get_dir_hash(image_path) will, from the same walk; only
+      # directories, links and regular files are copied.
+      #
+      # The tree is walked once to create the directories and links; the files
+      # are then streamed by COPY_THREADS threads, largest first, using
+      # IO.copy_stream so the kernel moves the data (copy_file_range/sendfile)
+      # without it passing through Ruby.
       def copy_to_image_path
-        FileUtils.cp_r(mount_path + "/.", image_path)
+        directories, links, files = [], [], []
+        Find.find(mount_path) do
+        |path|
+          next if path == mount_path
+          relative = path.sub("#{mount_path}/", "")
+          stat = File.lstat(path)
+          if stat.symlink?
+            links << relative
+          elsif stat.directory?
+            directories << relative
+          elsif stat.file?
+            files << [relative, stat.size, stat.mode & 07777]
+          else
+            # a FIFO or device node would block the copy, or copy the wrong thing
+            logger.warn "Skipping #{stat.ftype} #{relative} in #{mount_path}"
+          end
+        end
+
+        directories.each { |relative| Dir.mkdir(File.join(image_path, relative)) }
+        links.each { |relative| File.symlink(File.readlink(File.join(mount_path, relative)), File.join(image_path, relative)) }
+        copy_files(files.sort_by { |file| -file[1] })
+
+        dir_hash(directories + links + files.map { |file| file[0] })
+      end
+
+      # Copies each of 'files' ([relative path, size, mode]) from the mount path to
+      # the image path in parallel, logging progress, and raising the first error
+      def copy_files(files)
+        total  = files.inject(0) { |sum, file| sum + file[1] }
+        queue  = Queue.new
+        files.each { |file| queue << file }
+        lock   = Mutex.new
+        copied = 0
+        error  = nil
+        start  = Time.now
+
+        threads = (1..[COPY_THREADS, files.count].min).map do
+          Thread.new do
+            begin
+              loop do
+                begin
+                  relative, size, mode = queue.pop(true)
+                rescue ThreadError
+                  break         # queue is empty
+                end
+                break if error
+                source = File.join(mount_path, relative)
+                target = File.join(image_path, relative)
+                File.open(source, "rb") do
+                |input|
+                  File.open(target, File::WRONLY | File::CREAT | File::TRUNC | File::BINARY, mode | 0200) do
+                  |output|
+                    written = IO.copy_stream(input, output)
+                    raise "Short copy of #{relative}: #{written} of #{size} bytes" unless written == size
+                  end
+                end
+                File.chmod(mode, target)
+                lock.synchronize { copied += size }
+              end
+            rescue => e
+              lock.synchronize { error ||= e }
+            end
+          end
+        end
+
+        threads.each do
+        |thread|
+          until thread.join(COPY_PROGRESS_INTERVAL)
+            log_copy_progress(lock.synchronize { copied }, total, start)
+          end
+        end
+        raise error if error
+        log_copy_progress(copied, total, start)
+      end
+
+      def log_copy_progress(copied, total, start)
+        elapsed = [Time.now - start, 0.001].max
+        logger.info "Copied #{copied / 1048576} of #{total / 1048576} MB to #{image_path} " +
+                    "(#{format("%.1f", copied / 1048576.0 / elapsed)} MB/s)"
       end
 
       def get_dir_hash(dir)
         logger.debug "Generating hash for path: #{dir}"
 
-        files_string = Dir.glob("#{dir}/**/*").map {|x| x.sub("#{dir}/","")}.sort.join("\n")
-        Digest::SHA2.hexdigest(files_string)
+        dir_hash(Dir.glob("#{dir}/**/*").map {|x| x.sub("#{dir}/","")})
+      end
+
+      # Hashes a list of paths relative to an image directory, leaving out those
+      # that Dir.glob would not list (anything under a dot file or directory)
+      def dir_hash(relative_paths)
+        visible = relative_paths.reject { |path| path.split("/").any? { |name| name.start_with?(".") } }
+        Digest::SHA2.hexdigest(visible.sort.join("\n"))
       end
 
 
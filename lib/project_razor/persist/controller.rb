@@ -112,6 +112,13 @@ module ProjectRazor
         logger.debug "Removing all object documents from collection(#{collection})"
         @database.object_doc_remove_all(collection)
       end
+
+      # Remove superseded versions of object documents from every collection
+      # @return [Integer] The number of versions removed
+      def compact_history
+        logger.debug "Compacting object document history"
+        @database.compact_history
+      end
     end
   end
 end
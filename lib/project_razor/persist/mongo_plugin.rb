@@ -26,9 +26,10 @@ module ProjectRazor
       # @param username [String] Username that will be used to authenticate to the host
       # @param password [String] Password that will be used to authenticate to the host
       # @param timeout [Integer] Connection timeout
+      # @param database [String] The database to use, other than the ProjectRazor one
       # @return [Boolean] Connection status
       #
-      def connect(hostname, port, username, password, timeout)
+      def connect(hostname, port, username, password, timeout, database = "project_razor")
         logger.debug "Connecting to MongoDB (#{hostname}:#{port}) with timeout (#{timeout})"
         begin
           @connection = Mongo::Connection.new(hostname, port, { :connect_timeout => timeout })
@@ -45,7 +46,7 @@ module ProjectRazor
           logger.error "Mongo::OperationTimeout"
           return false
         end
-        @razor_database = @connection.db("project_razor")
+        @razor_database = @connection.db(database)
         @connection.active?
       end
 
@@ -69,29 +70,16 @@ module ProjectRazor
       end
 
 
-      # Returns the newest/unique documents from the collection named 'collection_name'
-      # All older/duplicate documents are removed from the collection.
+      # Returns the newest version of every document in the collection named 'collection_name'.
+      # This reads only the latest-version collection, so the cost does not grow with the
+      # number of historical versions.
       #
       # @param collection_name [Symbol]
       # @return [Array<Hash>]
       #
       def object_doc_get_all(collection_name)
-        collection_by_name(collection_name).create_index("@version") #ensure index on version
         logger.debug "Get all documents from collection (#{collection_name})"
-        objects_set   = Set.new # Set to hold uuid's for version checking. Using a Set for speed reasons.
-        old_objects   = [] # outdated versions of objects
-        objects_array = [] # objects to return
-        this          = collection_by_name(collection_name).find().sort("@version", -1).to_a
-        this.each do
-        |object|
-          if objects_set.add?(object['@uuid'])
-            objects_array << object
-          else
-            old_objects << object
-          end
-        end
-        cleanup_old_docs(old_objects, collection_name) if old_objects.count > 0 # only run clean if we need to
-        remove_mongo_keys(objects_array)
+        remove_mongo_keys(latest_by_name(collection_name).find().to_a)
       end
 
       # Returns the entry keyed by the '@uuid' of the given 'object_doc' from the collection
@@ -102,18 +90,12 @@ module ProjectRazor
       # @return [Hash] or nil if the object cannot be found
       #
       def object_doc_get_by_uuid(object_doc, collection_name)
-        collection_by_name(collection_name).create_index("@uuid") #ensure index on uuid
         logger.debug "Get document from collection (#{collection_name}) with uuid (#{object_doc['@uuid']})"
-        object_array = collection_by_name(collection_name).find("@uuid" => object_doc["@uuid"]).sort("@version", -1).to_a
-        if object_array.count > 0
-          object_array[0]
-        else
-          nil
-        end
+        latest_by_name(collection_name).find_one("@uuid" => object_doc["@uuid"])
       end
 
       # Adds or updates 'obj_document' in the collection named 'collection_name' with an incremented
-      # '@version' value
+      # '@version' value; the versions it supersedes stay in the history until {#compact_history}
       #
       # @param object_doc [Hash]
       # @param collection_name [Symbol]
@@ -121,10 +103,8 @@ module ProjectRazor
       #
       def object_doc_update(object_doc, collection_name)
         logger.debug "Update document in collection (#{collection_name}) with uuid (#{object_doc['@uuid']})"
-        # We use this to always pull newest
-        object_doc["@version"] = get_next_version(object_doc, collection_name)
-        collection_by_name(collection_name).insert(object_doc)
-        # Remove all older versions
+        store_latest(object_doc, collection_name)
+        collection_by_name(collection_name).insert(without_mongo_id(object_doc))
         object_doc
       end
 
@@ -137,12 +117,11 @@ module ProjectRazor
       #
       def object_doc_update_multi(object_docs, collection_name)
         logger.debug "Update documents in collection (#{collection_name})"
-        # We use this to always pull newest
         object_docs.each do
         |object_doc|
-          object_doc["@version"] = get_next_version(object_doc, collection_name)
+          store_latest(object_doc, collection_name)
         end
-        collection_by_name(collection_name).insert(object_docs)
+        collection_by_name(collection_name).insert(object_docs.map { |doc| without_mongo_id(doc) })
         object_docs
       end
 
@@ -155,10 +134,9 @@ module ProjectRazor
       #
       def object_doc_remove(object_doc, collection_name)
         logger.debug "Remove document in collection (#{collection_name}) with uuid (#{object_doc['@uuid']})"
-        while collection_by_name(collection_name).find({ "@uuid" => object_doc["@uuid"] }).count > 0
-          unless collection_by_name(collection_name).remove({ "@uuid" => object_doc["@uuid"] })
-            return false
-          end
+        [latest_by_name(collection_name), collection_by_name(collection_name)].each do
+        |collection|
+          return false unless collection.remove({ "@uuid" => object_doc["@uuid"] })
         end
         true
       end
@@ -170,30 +148,90 @@ module ProjectRazor
       #
       def object_doc_remove_all(collection_name)
         logger.debug "Remove all documents in collection (#{collection_name})"
-        while collection_by_name(collection_name).count > 0
-          unless collection_by_name(collection_name).remove()
-            return false
-          end
+        [latest_by_name(collection_name), collection_by_name(collection_name)].each do
+        |collection|
+          return false unless collection.remove()
         end
         true
       end
 
+      # Removes every historical version older than the latest version of each document, in
+      # every collection. Updates leave the versions they supersede, so that writes stay cheap,
+      # and the daemon runs this now and then; a collection whose history holds no more
+      # documents than its latest versions is skipped without reading it.
+      #
+      # @return [Integer] The number of versions removed
+      #
+      def compact_history
+        logger.debug "Compact document history"
+        removed = 0
+        @razor_database.collection_names.select { |name| name.end_with?(LATEST_SUFFIX) }.each do
+        |latest_name|
+          history = @razor_database.collection(latest_name.chomp(LATEST_SUFFIX))
+          latest  = @razor_database.collection(latest_name)
+          next if history.count <= latest.count
+          latest.find({}, :fields => ["@uuid", "@version"]).each do
+          |latest|
+            result = history.remove({ "@uuid" => latest["@uuid"], "@version" => { "$lt" => latest["@version"] } },
+                                    :safe => true)
+            removed += result["n"].to_i if result.is_a?(Hash)
+          end
+        end
+        removed
+      end
+
 
       private # Mongo internal stuff we don't want exposed'
 
-      # Gets the current version number and returns an incremented value, or returns '1' if none exists
+      # The latest version of each document is kept in a collection of its own, with this suffix
+      # on the name of the collection holding the full version history.
+      LATEST_SUFFIX = ".latest"
+
+      # Stores 'object_doc' as the latest version of its document, setting '@version' to the next
+      # version. Versions are allocated atomically by the database, so concurrent writers never
+      # share a version, and the newest version always wins.
+      # @param object_doc [Hash]
+      # @param collection_name [Symbol]
+      def store_latest(object_doc, collection_name)
+        latest = latest_by_name(collection_name)
+        object_doc["@version"] = get_next_version(object_doc, collection_name)
+        # if someone else bumped the version since, their update is newer than ours
+        latest.update({ "@uuid" => object_doc["@uuid"], "@version" => object_doc["@version"] },
+                      without_mongo_id(object_doc))
+      end
+
+      # Atomically increments the version of the latest document, or inserts a first version if none
+      # exists, and returns the new version number
       # @param object_doc [Hash]
       # @param collection_name [String]
       def get_next_version(object_doc, collection_name)
         logger.debug "Get next version number for document in collection (#{collection_name}) with uuid (#{object_doc['@uuid']})"
-        object_array =collection_by_name(collection_name).find("@uuid" => object_doc["@uuid"]).sort("@version", -1).to_a
-        if object_array.count < 1
-          version = 0
-        else
-          version = object_array[0]["@version"]
+        latest = latest_by_name(collection_name)
+        loop do
+          begin
+            current = latest.find_and_modify(:query  => { "@uuid" => object_doc["@uuid"] },
+                                             :update => { "$inc" => { "@version" => 1 } },
+                                             :fields => { "@version" => 1 },
+                                             :new    => true)
+          rescue Mongo::OperationFailure
+            current = nil       # older servers report no match as a failure
+          end
+          return current["@version"] if current
+
+          begin
+            latest.insert(without_mongo_id(object_doc).merge("@version" => 1), :safe => true)
+            return 1
+          rescue Mongo::OperationFailure
+            # someone else created the first version since we looked; bump theirs
+          end
         end
-        version += 1
-        version
+      end
+
+      # Returns the copy of 'object_doc' to write, without any '_id' a previous insert added
+      # @param object_doc [Hash]
+      # @return [Hash]
+      def without_mongo_id(object_doc)
+        object_doc.reject { |key, _| key.to_s == "_id" }
       end
 
       # Takes [Array] of docs and removes MongoDB specific keys
@@ -212,20 +250,7 @@ module ProjectRazor
         object_doc_array # return modified object_doc_array
       end
 
-      # Takes an [Array] of docs and removes each from collection: 'collection_name'
-      # @param old_object_doc_array [Array]
-      # @param collection_name [Symbol]
-      def cleanup_old_docs(old_object_doc_array, collection_name)
-        logger.debug "Clean up old documents"
-        # iterate over each old doc
-        old_object_doc_array.each do
-        |old_object_doc|
-          # Remove it from MongoDB by referencing '_id' key
-          collection_by_name(collection_name).remove({ "_id" => old_object_doc["_id"] })
-        end
-      end
-
-      # Returns corresponding MongoDB Collection to 'collection_name'
+      # Returns corresponding MongoDB Collection to 'collection_name', holding every version
       # @param collection_name [Symbol]
       # @return [Mongo::Collection]
       def collection_by_name(collection_name)
@@ -236,6 +261,43 @@ module ProjectRazor
         end
       end
 
+      # Returns the MongoDB Collection holding the latest version of each document in
+      # 'collection_name', creating indexes and materializing it from history on first use
+      # @param collection_name [Symbol]
+      # @return [Mongo::Collection]
+      def latest_by_name(collection_name)
+        history = collection_by_name(collection_name)
+        latest  = @razor_database.collection(collection_name.to_s + LATEST_SUFFIX)
+        @prepared ||= Set.new
+        return latest unless @prepared.add?(collection_name.to_s)
+
+        history.create_index([["@uuid", Mongo::ASCENDING], ["@version", Mongo::DESCENDING]])
+        latest.create_index("@uuid", :unique => true)
+        materialize_latest(history, latest) if latest.count == 0 && history.count > 0
+        latest
+      end
+
+      # Builds the latest-version collection from the version history of a database written
+      # before it existed; this runs once, and later reads only touch the latest versions
+      # @param history [Mongo::Collection]
+      # @param latest [Mongo::Collection]
+      def materialize_latest(history, latest)
+        logger.debug "Materialize latest versions of (#{history.name})"
+        # in the order of the @uuid/@version index, so mongod need not sort the whole history in
+        # memory; the first version of each uuid is its newest
+        previous = nil
+        history.find().sort([["@uuid", Mongo::ASCENDING], ["@version", Mongo::DESCENDING]]).each do
+        |object_doc|
+          next if object_doc["@uuid"] == previous
+          previous = object_doc["@uuid"]
+          begin
+            latest.insert(without_mongo_id(object_doc), :safe => true)
+          rescue Mongo::OperationFailure
+            # a concurrent writer already stored a newer version
+          end
+        end
+      end
+
     end
   end
 end
@@ -103,6 +103,15 @@ module ProjectRazor
       def object_doc_remove_all(collection_name)
         raise NotImplementedError
       end
+
+      # Removes superseded versions of documents from every collection. Plugins that keep no
+      # version history have nothing to compact.
+      #
+      # @return [Integer] The number of versions removed
+      #
+      def compact_history
+        0
+      end
     end
   end
 end
@@ -1,12 +1,103 @@
 require 'spec_helper'
 require 'project_razor/image_service/base'
 
+require 'fileutils'
+
 describe ProjectRazor::ImageService::Base do
-  # REVISIT: this is a stub - we test that we can load the code, which is
-  # better than no testing at all, but not actually very interesting in the
-  # bigger picture.  When we write any real test for the class then this
-  # next to useless test should be removed. --daniel 2013-02-21
-  it "should exist as a constant" do
-    described_class.should be
+  let :image do described_class.new(nil) end
+
+  # a stand in for the mounted ISO, and the image path it is copied to
+  before :each do
+    @tmpdir = Dir.mktmpdir
+    @source = File.join(@tmpdir, "mount")
+    @target = File.join(@tmpdir, "image")
+    [@source, @target].each { |dir| Dir.mkdir(dir) }
+    image.stub(:mount_path => @source, :image_path => @target)
+  end
+
+  after :each do
+    FileUtils.rm_rf(@tmpdir)
+  end
+
+  def write(relative, content)
+    path = File.join(@source, relative)
+    FileUtils.mkdir_p(File.dirname(path))
+    File.open(path, "wb") { |file| file.write(content) }
+    path
+  end
+
+  def copied(relative)
+    File.join(@target, relative)
+  end
+
+  describe "#copy_to_image_path" do
+    it "should copy nested directories and their files" do
+      write("README", "top")
+      write("isolinux/boot/vmlinuz", "kernel" * 100000)
+      Dir.mkdir(File.join(@source, "empty"))
+
+      image.copy_to_image_path
+
+      File.read(copied("README")).should == "top"
+      File.read(copied("isolinux/boot/vmlinuz")).should == "kernel" * 100000
+      File.should be_directory copied("empty")
+    end
+
+    it "should keep the permissions of each file" do
+      File.chmod(0555, write("install.sh", "#!/bin/sh\n"))
+
+      image.copy_to_image_path
+
+      (File.stat(copied("install.sh")).mode & 07777).should == 0555
+    end
+
+    it "should copy symlinks as links, not what they point to" do
+      write("isolinux/vmlinuz", "kernel")
+      File.symlink("isolinux/vmlinuz", File.join(@source, "vmlinuz"))
+
+      image.copy_to_image_path
+
+      File.should be_symlink copied("vmlinuz")
+      File.readlink(copied("vmlinuz")).should == "isolinux/vmlinuz"
+    end
+
+    it "should copy dot files, but leave them out of the hash as Dir.glob does" do
+      write(".disk/info", "disk")
+      write(".treeinfo", "tree")
+      write("README", "top")
+
+      hash = image.copy_to_image_path
+
+      File.read(copied(".disk/info")).should == "disk"
+      File.read(copied(".treeinfo")).should == "tree"
+      hash.should == image.get_dir_hash(@target)
+    end
+
+    it "should return the hash that get_dir_hash gives the copy" do
+      write("README", "top")
+      write("pool/main/l/linux/linux-image.deb", "package")
+      File.symlink("pool", File.join(@source, "packages"))
+      Dir.mkdir(File.join(@source, "empty"))
+
+      image.copy_to_image_path.should == image.get_dir_hash(@target)
+      image.get_dir_hash(@target).should == image.get_dir_hash(@source)
+    end
+
+    it "should skip anything but directories, links and regular files" do
+      write("README", "top")
+      File.mkfifo(File.join(@source, "fifo"))
+
+      image.copy_to_image_path
+
+      File.should exist copied("README")
+      File.should_not exist copied("fifo")
+    end
+
+    it "should raise an error if a file is copied short" do
+      write("README", "top" * 1000)
+      IO.stub(:copy_stream).and_return(0)
+
+      expect { image.copy_to_image_path }.to raise_error(/Short copy of README/)
+    end
   end
 end
@@ -2,11 +2,111 @@ require 'spec_helper'
 require 'project_razor/persist/mongo_plugin'
 
 describe ProjectRazor::Persist::MongoPlugin do
-  # REVISIT: this is a stub - we test that we can load the code, which is
-  # better than no testing at all, but not actually very interesting in the
-  # bigger picture.  When we write any real test for the class then this
-  # next to useless test should be removed. --daniel 2013-02-21
-  it "should exist as a constant" do
-    described_class.should be
+  # These need a mongod on localhost, and are pending without one.  They work
+  # in a database of their own, dropped after each example, so they never
+  # touch the real ProjectRazor data.
+  let :database   do "razor_spec_#{Process.pid}" end
+  let :collection do :spec_objects end
+
+  before :each do
+    @plugins = []
+  end
+
+  after :each do
+    unless @plugins.empty?
+      @plugins.each { |plugin| plugin.teardown }
+      Mongo::Connection.new("localhost", 27017).drop_database(database)
+    end
+  end
+
+  # a plugin with a connection of its own, as each Razor process has
+  def connected_plugin
+    plugin = described_class.new
+    pending "no mongod on localhost:27017" unless plugin.connect("localhost", 27017, "", "", 2, database)
+    @plugins << plugin
+    plugin
+  end
+
+  # the version history, read and written behind the plugin's back
+  def history
+    @history ||= Mongo::Connection.new("localhost", 27017).db(database).collection(collection.to_s)
+  end
+
+  describe "#object_doc_update" do
+    it "should bump the version on each update" do
+      plugin = connected_plugin
+      3.times { |i| plugin.object_doc_update({ "@uuid" => "node", "@checkin" => i }, collection) }
+
+      latest = plugin.object_doc_get_by_uuid({ "@uuid" => "node" }, collection)
+      latest["@version"].should == 3
+      latest["@checkin"].should == 2
+    end
+
+    it "should keep the newest version when writers race" do
+      first  = connected_plugin
+      second = connected_plugin
+      first.object_doc_update({ "@uuid" => "node", "@by" => "setup" }, collection)
+
+      # the first writer takes version 2, then the second writes version 3
+      # before the first stores its copy
+      first.define_singleton_method(:get_next_version) do |*args|
+        version = super(*args)
+        second.object_doc_update({ "@uuid" => "node", "@by" => "second" }, collection)
+        version
+      end
+      first.object_doc_update({ "@uuid" => "node", "@by" => "first" }, collection)
+
+      latest = second.object_doc_get_by_uuid({ "@uuid" => "node" }, collection)
+      latest["@version"].should == 3
+      latest["@by"].should == "second"
+      history.find("@uuid" => "node").map { |doc| doc["@version"] }.sort.should == [1, 2, 3]
+    end
+
+    it "should leave the superseded versions in the history" do
+      plugin = connected_plugin
+      3.times { plugin.object_doc_update({ "@uuid" => "node" }, collection) }
+
+      history.find("@uuid" => "node").count.should == 3
+    end
+  end
+
+  describe "materializing the latest versions" do
+    it "should find the newest version of each document in an older database" do
+      [["a", 1], ["a", 3], ["a", 2], ["b", 1]].each do |uuid, version|
+        history.insert("@uuid" => uuid, "@version" => version)
+      end
+
+      plugin = connected_plugin
+      docs = plugin.object_doc_get_all(collection).sort_by { |doc| doc["@uuid"] }
+      docs.map { |doc| [doc["@uuid"], doc["@version"]] }.should == [["a", 3], ["b", 1]]
+    end
+
+    it "should carry on from the newest version" do
+      [["a", 1], ["a", 2]].each do |uuid, version|
+        history.insert("@uuid" => uuid, "@version" => version)
+      end
+
+      plugin = connected_plugin
+      plugin.object_doc_update({ "@uuid" => "a" }, collection)["@version"].should == 3
+    end
+  end
+
+  describe "#compact_history" do
+    it "should remove every version but the latest" do
+      plugin = connected_plugin
+      3.times { plugin.object_doc_update({ "@uuid" => "a" }, collection) }
+      plugin.object_doc_update({ "@uuid" => "b" }, collection)
+
+      plugin.compact_history.should == 2
+      history.find.map { |doc| [doc["@uuid"], doc["@version"]] }.sort.should == [["a", 3], ["b", 1]]
+    end
+
+    it "should find nothing to remove a second time" do
+      plugin = connected_plugin
+      2.times { plugin.object_doc_update({ "@uuid" => "a" }, collection) }
+
+      plugin.compact_history.should == 1
+      plugin.compact_history.should == 0
+    end
   end
 end
@@ -0,0 +1,54 @@
+#!/usr/bin/env ruby
+#
+# Times the persistence plugins against a collection of objects that have each
+# been updated many times, as nodes are by their checkins:
+#
+#   ruby test_scripts/persist_benchmark.rb [objects] [versions] [mongo host]
+#
+# The mongo plugin needs a mongod on the given host (default localhost:27017);
+# it works in a scratch database, dropped when done.
+$LOAD_PATH << File.expand_path("../../lib", __FILE__)
+require "project_razor"
+require "benchmark"
+
+objects  = (ARGV[0] || 500).to_i
+versions = (ARGV[1] || 20).to_i
+host     = ARGV[2] || "localhost"
+scratch  = :persist_benchmark
+database = "razor_persist_benchmark"
+
+plugins = { "memory" => ProjectRazor::Persist::MemoryPlugin.new }
+mongo = ProjectRazor::Persist::MongoPlugin.new
+if mongo.connect(host, 27017, "", "", 10, database)
+  plugins["mongo"] = mongo
+else
+  puts "No mongod on #{host}:27017, timing the memory plugin only"
+end
+
+puts "#{objects} objects, #{versions} versions each"
+plugins.each do
+|name, plugin|
+  plugin.connect(host, 27017, "", "", 10) if name == "memory"
+  plugin.object_doc_remove_all(scratch)
+  uuids = (1..objects).map { |i| "benchmark-#{i}" }
+
+  Benchmark.bm(24) do
+  |bm|
+    bm.report("#{name} update") do
+      versions.times do
+      |version|
+        uuids.each { |uuid| plugin.object_doc_update({ "@uuid" => uuid, "@checkin" => version }, scratch) }
+      end
+    end
+    bm.report("#{name} get all") { 100.times { plugin.object_doc_get_all(scratch) } }
+    bm.report("#{name} get by uuid") do
+      uuids.each { |uuid| plugin.object_doc_get_by_uuid({ "@uuid" => uuid }, scratch) }
+    end
+  end
+
+  plugin.object_doc_remove_all(scratch)
+  plugin.teardown
+end
+
+# the collections and their indexes go with the database
+Mongo::Connection.new(host, 27017).drop_database(database) if plugins["mongo"]